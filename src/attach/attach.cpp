@@ -0,0 +1,92 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../libdatamon/remote_monitor.hpp"
+
+// monitors data in a running process from the outside:
+//
+//   datamon-attach <pid> <mode>:<address>:<size>...
+//
+// mode is one of writes, accesses or guard, the address is hexadecimal. the
+// accesses are printed until enter is pressed or the process exits
+
+struct WatchArgument {
+  datamon::RemoteMonitor::Mode mode;
+  uintptr_t address;
+  size_t size;
+};
+
+bool parse_watch(const std::string& argument, WatchArgument& watch) {
+  const size_t first = argument.find(':');
+  const size_t second = argument.find(':', first + 1);
+  if (first == std::string::npos || second == std::string::npos) {
+    return false;
+  }
+
+  const std::string mode = argument.substr(0, first);
+  if (mode == "writes") {
+    watch.mode = datamon::RemoteMonitor::Mode::writes;
+  } else if (mode == "accesses") {
+    watch.mode = datamon::RemoteMonitor::Mode::accesses;
+  } else if (mode == "guard") {
+    watch.mode = datamon::RemoteMonitor::Mode::guard;
+  } else {
+    return false;
+  }
+
+  try {
+    watch.address = static_cast<uintptr_t>(
+        std::stoull(argument.substr(first + 1, second - first - 1), nullptr,
+                    16));
+    watch.size = static_cast<size_t>(std::stoull(argument.substr(second + 1)));
+  } catch (const std::exception&) {
+    return false;
+  }
+
+  return watch.size != 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "usage: datamon-attach <pid> <mode>:<address>:<size>...\n"
+                 "  mode: writes, accesses or guard\n";
+    return 1;
+  }
+
+  std::vector<WatchArgument> watches;
+  for (int i = 2; i < argc; ++i) {
+    WatchArgument watch;
+    if (!parse_watch(argv[i], watch)) {
+      std::cerr << "invalid watch: " << argv[i] << '\n';
+      return 1;
+    }
+    watches.push_back(watch);
+  }
+
+  try {
+    datamon::RemoteMonitor monitor{
+        static_cast<uint32_t>(std::stoul(argv[1])),
+        [](const datamon::Event& event) {
+          std::cout << event.timestamp << ' ' << event.thread_id << ' '
+                    << (event.read ? "read" : "write") << " data: " << std::hex
+                    << reinterpret_cast<uintptr_t>(event.data)
+                    << ", caused from: "
+                    << reinterpret_cast<uintptr_t>(event.accessing_address)
+                    << std::dec << '\n';
+        }};
+
+    for (const WatchArgument& watch : watches) {
+      monitor.add_watch(watch.address, watch.size, watch.mode);
+    }
+
+    std::cout << "attached, press enter to detach\n";
+    std::cin.get();
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+
+  return 0;
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <thread>
 
+#include "../libdatamon/layout_advisor.hpp"
 #include "../libdatamon/libdatamon.hpp"
 
 // example data that we want to monitor for read/write access
@@ -31,6 +32,46 @@ void callback(void* accessing_address, bool read, void* data) {
             << ".\n";
 }
 
+void layout_demo() {
+  // collect access statistics for a second player, updated by two threads
+  auto player = std::make_unique<Player>();
+
+  datamon::LayoutAdvisor advisor{player.get(),
+                                 sizeof(*player),
+                                 {DATAMON_FIELD(Player, health),
+                                  DATAMON_FIELD(Player, armor),
+                                  DATAMON_FIELD(Player, ammo),
+                                  DATAMON_FIELD(Player, name)}};
+
+  // the worker thread keeps writing ammo while the main thread works with
+  // health and armor
+  std::thread worker{[&player] {
+    for (int i = 0; i < 100; ++i) {
+      player->ammo = i;
+    }
+  }};
+
+  for (int i = 0; i < 100; ++i) {
+    player->health = player->armor + i;
+  }
+
+  worker.join();
+
+  auto report = advisor.report();
+
+  std::cout << "Hot fields currently span " << report.current_hot_lines
+            << " cache line(s), proposed layout:\n";
+  for (size_t line = 0; line < report.lines.size(); ++line) {
+    std::cout << "  line " << line << ":";
+    for (size_t index : report.lines[line]) {
+      const auto& stats = report.fields[index];
+      std::cout << " " << stats.field.name << " (" << stats.reads << "r/"
+                << stats.writes << "w)";
+    }
+    std::cout << "\n";
+  }
+}
+
 int main() {
   // wait a bit to ensure console is ready
   std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -77,6 +118,9 @@ int main() {
   strcpy_s(name, player->name);
   std::cout << "Name: " << name << "\n";
 
+  std::cout << "Running the layout advisor...\n";
+  layout_demo();
+
   // wait for user input to exit
   std::cout << "Press enter to exit..." << std::endl;
   std::cin.get();
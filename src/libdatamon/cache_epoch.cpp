@@ -0,0 +1,74 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "cache_epoch.hpp"
+
+#include "watch.hpp"
+
+datamon::CacheEpoch::CacheEpoch(std::vector<Region> inputs)
+    : inputs_(std::move(inputs)) {
+  for (const auto& input : inputs_) {
+    watch_ids_.push_back(detail::add_watch(
+        input.address, input.size,
+        [this](const Event&) {
+          std::unique_lock lock{mutex_};
+
+          // the handler disarms the hit page, disarm the other inputs too so
+          // they stay untrapped until the next fill
+          invalidate_locked();
+        },
+        detail::Trap::write_once));
+  }
+}
+
+datamon::CacheEpoch::~CacheEpoch() {
+  invalidate();
+
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    detail::remove_watch(watch_ids_[i], inputs_[i].address, inputs_[i].size);
+  }
+}
+
+uint64_t datamon::CacheEpoch::begin_fill() {
+  std::unique_lock lock{mutex_};
+
+  if (!armed_) {
+    for (const auto& input : inputs_) {
+      detail::arm_writes(input.address, input.size);
+    }
+    armed_ = true;
+  }
+
+  return epoch_.load(std::memory_order_relaxed);
+}
+
+bool datamon::CacheEpoch::end_fill(uint64_t token) {
+  std::unique_lock lock{mutex_};
+
+  if (armed_ && epoch_.load(std::memory_order_relaxed) == token) {
+    valid_.store(true, std::memory_order_release);
+    return true;
+  }
+
+  return false;
+}
+
+void datamon::CacheEpoch::invalidate() {
+  std::unique_lock lock{mutex_};
+  invalidate_locked();
+}
+
+void datamon::CacheEpoch::invalidate_locked() {
+  if (!armed_) {
+    return;
+  }
+
+  for (const auto& input : inputs_) {
+    detail::disarm_writes(input.address, input.size);
+  }
+
+  armed_ = false;
+  valid_.store(false, std::memory_order_release);
+  epoch_.fetch_add(1, std::memory_order_acq_rel);
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "region.hpp"
+
+namespace datamon {
+
+//! @brief Tracks whether a value derived from some input regions is still
+//! valid. Filling arms write traps on the inputs; the first write to any of
+//! them invalidates the value and disarms all inputs until the next fill, so
+//! invalidation costs one exception and checking validity costs an atomic
+//! load. Inputs are tracked per page, so writes to other data on the same
+//! pages invalidate the value too.
+class CacheEpoch {
+ public:
+  //! @brief Creates a new epoch for a value derived from a set of regions.
+  //! The value starts out invalid.
+  explicit CacheEpoch(std::vector<Region> inputs);
+  ~CacheEpoch();
+
+  CacheEpoch(const CacheEpoch&) = delete;
+  CacheEpoch(CacheEpoch&&) = delete;
+  CacheEpoch& operator=(const CacheEpoch&) = delete;
+  CacheEpoch& operator=(CacheEpoch&&) = delete;
+
+  //! @brief Whether no input was written since the value was filled.
+  bool valid() const { return valid_.load(std::memory_order_acquire); }
+
+  //! @brief The number of times the value was invalidated.
+  uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+  //! @brief Arms the inputs before the value is computed from them.
+  //! @return The token to pass to end_fill.
+  uint64_t begin_fill();
+
+  //! @brief Marks the value as valid, unless an input was written since the
+  //! matching begin_fill.
+  //! @param token The token returned by begin_fill.
+  //! @return Whether the value is valid.
+  bool end_fill(uint64_t token);
+
+  //! @brief Invalidates the value without waiting for a write.
+  void invalidate();
+
+ private:
+  // expects mutex_ to be held
+  void invalidate_locked();
+
+  std::vector<Region> inputs_;
+  std::vector<size_t> watch_ids_;
+
+  std::mutex mutex_;
+  bool armed_ = false;
+  std::atomic<bool> valid_ = false;
+  std::atomic<uint64_t> epoch_ = 0;
+};
+
+//! @brief A value that is recomputed from its inputs only after they were
+//! written. Not synchronised: concurrent calls to get() need external
+//! locking, as with any other cache.
+//! @tparam T The type of the value.
+template <typename T>
+class Memoized {
+ public:
+  //! @brief Creates a new memoized value.
+  //! @param inputs The regions the value is computed from.
+  //! @param compute Computes the value from the inputs.
+  Memoized(std::vector<Region> inputs, std::function<T()> compute)
+      : epoch_(std::move(inputs)), compute_(std::move(compute)) {}
+
+  //! @brief Returns the cached value, recomputing it if an input was written
+  //! since it was last computed.
+  const T& get() {
+    if (!value_ || !epoch_.valid()) {
+      const uint64_t token = epoch_.begin_fill();
+      value_ = compute_();
+      epoch_.end_fill(token);
+    }
+    return *value_;
+  }
+
+  //! @brief The epoch tracking the inputs.
+  const CacheEpoch& epoch() const { return epoch_; }
+
+ private:
+  CacheEpoch epoch_;
+  std::function<T()> compute_;
+  std::optional<T> value_;
+};
+
+}  // namespace datamon
\ No newline at end of file
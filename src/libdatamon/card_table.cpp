@@ -0,0 +1,108 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "card_table.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#include "watch.hpp"
+
+datamon::CardTable::CardTable(void* address, size_t size) {
+  const size_t page_size = detail::page_size();
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address);
+
+  base_ = address_value & ~(page_size - 1);
+  card_count_ = (address_value + size - base_ + page_size - 1) / page_size;
+  dirty_.resize((card_count_ + 63) / 64);
+
+  watch_id_ = detail::add_watch(
+      reinterpret_cast<void*>(base_), card_count_ * page_size,
+      [this, page_size](const Event& event) {
+        const size_t card =
+            (reinterpret_cast<uintptr_t>(event.data) - base_) / page_size;
+
+        std::unique_lock lock{mutex_};
+        dirty_[card / 64] |= 1ull << (card % 64);
+      },
+      detail::Trap::write_once);
+
+  detail::arm_writes(reinterpret_cast<void*>(base_), card_count_ * page_size);
+}
+
+datamon::CardTable::~CardTable() {
+  const size_t page_size = detail::page_size();
+
+  {
+    // the clean cards are the ones that are still armed
+    std::unique_lock lock{mutex_};
+    size_t card = 0;
+    while (card < card_count_) {
+      if (dirty_[card / 64] & (1ull << (card % 64))) {
+        ++card;
+        continue;
+      }
+
+      size_t run_end = card;
+      while (run_end < card_count_ &&
+             !(dirty_[run_end / 64] & (1ull << (run_end % 64)))) {
+        ++run_end;
+      }
+
+      detail::disarm_writes(reinterpret_cast<void*>(base_ + card * page_size),
+                            (run_end - card) * page_size);
+      card = run_end;
+    }
+  }
+
+  detail::remove_watch(watch_id_, reinterpret_cast<void*>(base_),
+                       card_count_ * page_size);
+}
+
+size_t datamon::CardTable::card_size() const { return detail::page_size(); }
+
+void* datamon::CardTable::card_address(size_t card) const {
+  return reinterpret_cast<void*>(base_ + card * detail::page_size());
+}
+
+bool datamon::CardTable::dirty(size_t card) const {
+  std::unique_lock lock{mutex_};
+  return dirty_[card / 64] & (1ull << (card % 64));
+}
+
+std::vector<size_t> datamon::CardTable::collect_and_reset() {
+  const size_t page_size = detail::page_size();
+
+  std::vector<size_t> cards;
+
+  // the lock keeps writes that fault on re-armed cards from marking them
+  // before their bits are cleared
+  std::unique_lock lock{mutex_};
+
+  for (size_t word = 0; word < dirty_.size(); ++word) {
+    uint64_t bits = dirty_[word];
+    while (bits) {
+      cards.push_back(word * 64 + std::countr_zero(bits));
+      bits &= bits - 1;
+    }
+  }
+
+  // re-arm runs of consecutive cards together
+  size_t i = 0;
+  while (i < cards.size()) {
+    size_t run_end = i + 1;
+    while (run_end < cards.size() &&
+           cards[run_end] == cards[run_end - 1] + 1) {
+      ++run_end;
+    }
+
+    detail::arm_writes(reinterpret_cast<void*>(base_ + cards[i] * page_size),
+                       (run_end - i) * page_size);
+    i = run_end;
+  }
+
+  std::fill(dirty_.begin(), dirty_.end(), 0);
+
+  return cards;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace datamon {
+
+//! @brief A card marking write barrier over a region, with one card per page.
+//! The region is write protected and the first write to a card sets its bit
+//! and lets all further writes to it through at full speed, until the dirty
+//! cards are collected and re-armed. There are no callbacks per write.
+class CardTable {
+ public:
+  //! @brief Starts tracking writes to a region. The region is widened to
+  //! whole pages.
+  //! @param address The start of the region.
+  //! @param size The size of the region.
+  CardTable(void* address, size_t size);
+  ~CardTable();
+
+  CardTable(const CardTable&) = delete;
+  CardTable(CardTable&&) = delete;
+  CardTable& operator=(const CardTable&) = delete;
+  CardTable& operator=(CardTable&&) = delete;
+
+  //! @brief The size of a card, which is the page size.
+  size_t card_size() const;
+
+  //! @brief The number of cards in the region.
+  size_t card_count() const { return card_count_; }
+
+  //! @brief The start of a card.
+  void* card_address(size_t card) const;
+
+  //! @brief Whether a card was written since the last collection.
+  bool dirty(size_t card) const;
+
+  //! @brief Returns the cards written since the last collection in ascending
+  //! order, and re-arms them. Writes that happen while the returned cards
+  //! are scanned mark them dirty again for the next collection.
+  std::vector<size_t> collect_and_reset();
+
+ private:
+  uintptr_t base_;
+  size_t card_count_;
+
+  mutable std::mutex mutex_;
+  // one bit per card
+  std::vector<uint64_t> dirty_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
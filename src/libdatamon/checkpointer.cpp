@@ -0,0 +1,501 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "checkpointer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "watch.hpp"
+
+namespace {
+
+// "DMCKPT02"
+constexpr uint64_t record_magic = 0x323054504b434d44;
+
+enum class RecordKind : uint64_t {
+  // a header page followed by pages of a checkpoint
+  pages,
+  // a lone header page marking a checkpoint as complete
+  commit,
+};
+
+// the start of the header page of each record
+struct RecordHeader {
+  uint64_t magic;
+  RecordKind kind;
+  // the checkpoint the record belongs to: the file offset of its first record
+  uint64_t checkpoint;
+  uint64_t page_size;
+  // for pages, the number of pages following the header page. their offsets
+  // within the regions fill the rest of the header page. for a commit, the
+  // number of pages in the whole checkpoint
+  uint64_t page_count;
+};
+
+size_t offsets_per_header(size_t page_size) {
+  return (page_size - sizeof(RecordHeader)) / sizeof(uint64_t);
+}
+
+// WriteFile takes the size as a DWORD, larger checkpoints are split up
+constexpr size_t max_write_size = size_t{1} << 30;
+
+}  // namespace
+
+struct datamon::Checkpointer::Io {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  uint64_t file_offset = 0;
+
+  // page aligned copy of the dirty pages, as required for unbuffered writes
+  char* staging = nullptr;
+  size_t staging_size = 0;
+
+  // the writes in flight. only resized when nothing is in flight
+  std::vector<OVERLAPPED> writes;
+  // the indices of the pages in flight. they are clean only once their
+  // checkpoint is committed
+  std::vector<size_t> pages;
+
+  // the commit record of the checkpoint in flight. it is written only once
+  // all of the checkpoint's pages are, so a crash never leaves a commit
+  // record behind a torn checkpoint
+  char* commit = nullptr;
+  uint64_t commit_offset = 0;
+  bool commit_pending = false;
+
+  // waits for the writes in flight, then commits their checkpoint. returns
+  // whether all of it succeeded
+  bool wait() {
+    bool success = true;
+    for (auto& write : writes) {
+      DWORD written;
+      success &= GetOverlappedResult(file, &write, &written, TRUE) != FALSE;
+      CloseHandle(write.hEvent);
+    }
+    writes.clear();
+
+    if (commit_pending) {
+      commit_pending = false;
+      success = success && write_commit();
+    }
+    return success;
+  }
+
+  bool write_commit() {
+    OVERLAPPED write{};
+    write.Offset = static_cast<DWORD>(commit_offset);
+    write.OffsetHigh = static_cast<DWORD>(commit_offset >> 32);
+    write.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!write.hEvent) {
+      return false;
+    }
+
+    DWORD written;
+    const bool success =
+        (WriteFile(file, commit, static_cast<DWORD>(detail::page_size()),
+                   nullptr, &write) ||
+         GetLastError() == ERROR_IO_PENDING) &&
+        GetOverlappedResult(file, &write, &written, TRUE);
+    CloseHandle(write.hEvent);
+    return success;
+  }
+};
+
+datamon::Checkpointer::Checkpointer(std::vector<Region> regions,
+                                    const std::filesystem::path& path)
+    : io_(std::make_unique<Io>()) {
+  const size_t page_size = detail::page_size();
+
+  for (const auto& region : regions) {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(region.address);
+    const uintptr_t base = address & ~(page_size - 1);
+    const size_t page_count =
+        (address + region.size - base + page_size - 1) / page_size;
+    regions_.push_back({base, page_count, page_count_, 0});
+    page_count_ += page_count;
+  }
+
+  // everything is dirty until the base checkpoint is written
+  dirty_.assign(page_count_, true);
+  dirty_count_ = page_count_;
+
+  io_->file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                          nullptr, OPEN_ALWAYS,
+                          FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                          nullptr);
+  if (io_->file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error{"Failed to open checkpoint file."};
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(io_->file, &file_size) ||
+      file_size.QuadPart % page_size != 0) {
+    CloseHandle(io_->file);
+    throw std::runtime_error{"Not a checkpoint file."};
+  }
+  io_->file_offset = file_size.QuadPart;
+
+  io_->commit = static_cast<char*>(VirtualAlloc(
+      nullptr, page_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+  if (!io_->commit) {
+    CloseHandle(io_->file);
+    throw std::runtime_error{"Failed to allocate staging buffer."};
+  }
+
+  for (auto& region : regions_) {
+    region.watch_id = detail::add_watch(
+        reinterpret_cast<void*>(region.base), region.page_count * page_size,
+        [this, &region, page_size](const Event& event) {
+          const size_t index =
+              region.first_page +
+              (reinterpret_cast<uintptr_t>(event.data) - region.base) /
+                  page_size;
+
+          std::unique_lock lock{mutex_};
+          if (!dirty_[index]) {
+            dirty_[index] = true;
+            ++dirty_count_;
+          }
+        },
+        detail::Trap::write_once);
+  }
+}
+
+datamon::Checkpointer::~Checkpointer() {
+  const size_t page_size = detail::page_size();
+
+  complete_writes();
+
+  {
+    // the clean pages are the ones that are still armed
+    std::unique_lock lock{mutex_};
+    for (const auto& region : regions_) {
+      size_t page = 0;
+      while (page < region.page_count) {
+        if (dirty_[region.first_page + page]) {
+          ++page;
+          continue;
+        }
+
+        size_t run_end = page;
+        while (run_end < region.page_count &&
+               !dirty_[region.first_page + run_end]) {
+          ++run_end;
+        }
+
+        detail::disarm_writes(
+            reinterpret_cast<void*>(region.base + page * page_size),
+            (run_end - page) * page_size);
+        page = run_end;
+      }
+    }
+  }
+
+  for (const auto& region : regions_) {
+    detail::remove_watch(region.watch_id, reinterpret_cast<void*>(region.base),
+                         region.page_count * page_size);
+  }
+
+  if (io_->staging) {
+    VirtualFree(io_->staging, 0, MEM_RELEASE);
+  }
+  VirtualFree(io_->commit, 0, MEM_RELEASE);
+  CloseHandle(io_->file);
+}
+
+size_t datamon::Checkpointer::dirty_count() const {
+  std::unique_lock lock{mutex_};
+  return dirty_count_;
+}
+
+void datamon::Checkpointer::flush() {
+  if (!complete_writes()) {
+    throw std::runtime_error{"Failed to write checkpoint."};
+  }
+}
+
+bool datamon::Checkpointer::complete_writes() {
+  const bool success = io_->wait();
+  if (!success) {
+    // the checkpoint never got committed, so its pages go into the next one.
+    // they are still armed unless written to since, which would have made
+    // them dirty already
+    const size_t page_size = detail::page_size();
+    std::unique_lock lock{mutex_};
+    for (const size_t index : io_->pages) {
+      if (dirty_[index]) {
+        continue;
+      }
+
+      auto region = std::upper_bound(
+          regions_.begin(), regions_.end(), index,
+          [](size_t index, const RegionPages& region) {
+            return index < region.first_page;
+          });
+      --region;
+      detail::disarm_writes(
+          reinterpret_cast<void*>(region->base +
+                                  (index - region->first_page) * page_size),
+          page_size);
+
+      dirty_[index] = true;
+      ++dirty_count_;
+    }
+  }
+  io_->pages.clear();
+  return success;
+}
+
+size_t datamon::Checkpointer::checkpoint() {
+  // the staging buffer is reused, so the previous checkpoint has to be out
+  flush();
+
+  const size_t page_size = detail::page_size();
+  const size_t per_header = offsets_per_header(page_size);
+  const uint64_t id = io_->file_offset;
+
+  size_t count;
+  size_t total_size;
+  {
+    std::unique_lock lock{mutex_};
+
+    count = dirty_count_;
+    if (count == 0) {
+      return 0;
+    }
+
+    const size_t header_count = (count + per_header - 1) / per_header;
+    total_size = (count + header_count) * page_size;
+
+    if (io_->staging_size < total_size) {
+      if (io_->staging) {
+        VirtualFree(io_->staging, 0, MEM_RELEASE);
+      }
+      io_->staging = static_cast<char*>(VirtualAlloc(
+          nullptr, total_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+      io_->staging_size = io_->staging ? total_size : 0;
+      if (!io_->staging) {
+        throw std::runtime_error{"Failed to allocate staging buffer."};
+      }
+    }
+
+    // write protect the dirty pages before copying them. a write racing with
+    // the copy waits for the lock and marks the page dirty again afterwards
+    for (const auto& region : regions_) {
+      size_t page = 0;
+      while (page < region.page_count) {
+        if (!dirty_[region.first_page + page]) {
+          ++page;
+          continue;
+        }
+
+        size_t run_end = page;
+        while (run_end < region.page_count &&
+               dirty_[region.first_page + run_end]) {
+          ++run_end;
+        }
+
+        detail::arm_writes(
+            reinterpret_cast<void*>(region.base + page * page_size),
+            (run_end - page) * page_size);
+        page = run_end;
+      }
+    }
+
+    char* out = io_->staging;
+    size_t remaining = count;
+    uint64_t* offsets = nullptr;
+    size_t slot = 0;
+    size_t record_size = 0;
+
+    for (const auto& region : regions_) {
+      for (size_t page = 0; page < region.page_count; ++page) {
+        const size_t index = region.first_page + page;
+        if (!dirty_[index]) {
+          continue;
+        }
+
+        if (slot == record_size) {
+          // start a new record
+          record_size = std::min(per_header, remaining);
+          slot = 0;
+
+          std::memset(out, 0, page_size);
+          auto header = reinterpret_cast<RecordHeader*>(out);
+          *header = {record_magic, RecordKind::pages, id, page_size,
+                     record_size};
+          offsets = reinterpret_cast<uint64_t*>(header + 1);
+          out += page_size;
+        }
+
+        offsets[slot++] = index * page_size;
+        io_->pages.push_back(index);
+        std::memcpy(out,
+                    reinterpret_cast<const void*>(region.base +
+                                                  page * page_size),
+                    page_size);
+        out += page_size;
+
+        dirty_[index] = false;
+        --remaining;
+      }
+    }
+
+    dirty_count_ = 0;
+  }
+
+  std::memset(io_->commit, 0, page_size);
+  *reinterpret_cast<RecordHeader*>(io_->commit) = {
+      record_magic, RecordKind::commit, id, page_size, count};
+  io_->commit_offset = io_->file_offset + total_size;
+
+  // issue the writes and let them complete in the background
+  const size_t write_count = (total_size + max_write_size - 1) / max_write_size;
+  io_->writes.resize(write_count);
+  for (size_t i = 0; i < write_count; ++i) {
+    const size_t offset = i * max_write_size;
+    const uint64_t file_offset = io_->file_offset + offset;
+
+    OVERLAPPED& write = io_->writes[i];
+    write = {};
+    write.Offset = static_cast<DWORD>(file_offset);
+    write.OffsetHigh = static_cast<DWORD>(file_offset >> 32);
+    write.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+    if (!WriteFile(io_->file, io_->staging + offset,
+                   static_cast<DWORD>(
+                       std::min(max_write_size, total_size - offset)),
+                   nullptr, &write) &&
+        GetLastError() != ERROR_IO_PENDING) {
+      // don't wait for writes that were never issued
+      CloseHandle(write.hEvent);
+      io_->writes.resize(i);
+      complete_writes();
+      throw std::runtime_error{"Failed to write checkpoint."};
+    }
+  }
+  io_->file_offset += total_size + page_size;
+  io_->commit_pending = true;
+
+  return count;
+}
+
+size_t datamon::Checkpointer::restore(const std::vector<Region>& regions,
+                                      const std::filesystem::path& path) {
+  const size_t page_size = detail::page_size();
+  const size_t per_header = offsets_per_header(page_size);
+
+  // the page aligned start of each region, by its first logical page
+  std::vector<std::pair<size_t, uintptr_t>> bases;
+  size_t page_count = 0;
+  for (const auto& region : regions) {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(region.address);
+    const uintptr_t base = address & ~(page_size - 1);
+    bases.emplace_back(page_count, base);
+    page_count += (address + region.size - base + page_size - 1) / page_size;
+  }
+
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error{"Failed to open checkpoint file."};
+  }
+
+  const uint64_t file_size = std::filesystem::file_size(path);
+  uint64_t position = 0;
+
+  std::vector<char> header_page(page_size);
+  std::vector<char> page(page_size);
+
+  // the page records of the checkpoint that is not committed yet
+  std::vector<uint64_t> pending;
+  uint64_t pending_id = 0;
+  uint64_t pending_pages = 0;
+
+  auto apply = [&](uint64_t record) {
+    file.seekg(record);
+    file.read(header_page.data(), page_size);
+
+    RecordHeader header;
+    std::memcpy(&header, header_page.data(), sizeof(header));
+    const auto offsets = reinterpret_cast<const uint64_t*>(
+        header_page.data() + sizeof(RecordHeader));
+    for (size_t i = 0; i < header.page_count; ++i) {
+      file.read(page.data(), page_size);
+      if (!file) {
+        throw std::runtime_error{"Failed to read checkpoint file."};
+      }
+
+      const size_t index = offsets[i] / page_size;
+      if (index >= page_count) {
+        throw std::runtime_error{"Checkpoint does not match the regions."};
+      }
+
+      auto base = std::upper_bound(
+          bases.begin(), bases.end(), index,
+          [](size_t index, const auto& base) { return index < base.first; });
+      --base;
+      std::memcpy(
+          reinterpret_cast<void*>(base->second +
+                                  (index - base->first) * page_size),
+          page.data(), page_size);
+    }
+  };
+
+  size_t checkpoints = 0;
+
+  while (position + page_size <= file_size) {
+    file.seekg(position);
+    file.read(header_page.data(), page_size);
+
+    if (!file) {
+      break;
+    }
+
+    RecordHeader header;
+    std::memcpy(&header, header_page.data(), sizeof(header));
+    const bool commit = header.kind == RecordKind::commit;
+    const bool pages =
+        header.kind == RecordKind::pages && header.page_count <= per_header;
+    const uint64_t record_size =
+        pages ? (header.page_count + 1) * page_size : page_size;
+    if (header.magic != record_magic || header.page_size != page_size ||
+        !(commit || pages) || position + record_size > file_size) {
+      // torn, or never written by a checkpoint whose writes failed. the
+      // checkpoints after it may well be intact, so look for the next record
+      // page by page
+      position += page_size;
+      continue;
+    }
+
+    if (commit) {
+      // a checkpoint is applied only once all of its records are known to be
+      // there, so a crash during a checkpoint never leaves a torn state
+      if (!pending.empty() && header.checkpoint == pending_id &&
+          header.page_count == pending_pages) {
+        for (const uint64_t record : pending) {
+          apply(record);
+        }
+        ++checkpoints;
+      }
+      pending.clear();
+      position += page_size;
+      continue;
+    }
+
+    // records of an uncommitted checkpoint, e.g. one torn by a crash before
+    // the checkpointer appending to the file was created, are dropped
+    if (pending.empty() || header.checkpoint != pending_id) {
+      pending.clear();
+      pending_id = header.checkpoint;
+      pending_pages = 0;
+    }
+    pending.push_back(position);
+    pending_pages += header.page_count;
+
+    position += record_size;
+  }
+
+  return checkpoints;
+}
\ No newline at end of file
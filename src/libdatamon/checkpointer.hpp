@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "region.hpp"
+
+namespace datamon {
+
+//! @brief Incrementally checkpoints a set of regions to an append-only file.
+//! Pages are write protected after each checkpoint and the first write to a
+//! page marks it dirty, so every checkpoint only writes the pages that
+//! changed since the previous one. The first checkpoint writes everything
+//! and serves as the base.
+//!
+//! The file is a sequence of records, each a header page listing the offsets
+//! of the pages that follow it. A checkpoint may span several records and
+//! ends in a commit record, which is written only once all of its pages are
+//! on disk. restore() replays the committed checkpoints in order.
+class Checkpointer {
+ public:
+  //! @brief Starts tracking a set of regions. The regions are widened to
+  //! whole pages and must not overlap. Nothing is protected until the first
+  //! checkpoint.
+  //! @param regions The regions to checkpoint.
+  //! @param path The checkpoint file. Records are appended if it exists.
+  Checkpointer(std::vector<Region> regions, const std::filesystem::path& path);
+  ~Checkpointer();
+
+  Checkpointer(const Checkpointer&) = delete;
+  Checkpointer(Checkpointer&&) = delete;
+  Checkpointer& operator=(const Checkpointer&) = delete;
+  Checkpointer& operator=(Checkpointer&&) = delete;
+
+  //! @brief Copies the pages written since the last checkpoint and queues
+  //! them to be written to the file. Returns as soon as the write is issued;
+  //! the next checkpoint or flush() waits for it to complete and commits it.
+  //! @return The number of pages in the checkpoint.
+  size_t checkpoint();
+
+  //! @brief Waits until the last checkpoint is on disk and committed.
+  void flush();
+
+  //! @brief The number of pages written since the last checkpoint.
+  size_t dirty_count() const;
+
+  //! @brief Restores the regions from a checkpoint file by replaying all of
+  //! its committed checkpoints. A checkpoint without a commit record, e.g.
+  //! from a crash during the checkpoint, is ignored as a whole, and the
+  //! checkpoints written after it are still replayed.
+  //! @param regions The regions, in the same order and with the same sizes as
+  //! they were given to the checkpointer.
+  //! @param path The checkpoint file.
+  //! @return The number of checkpoints that were replayed.
+  static size_t restore(const std::vector<Region>& regions,
+                        const std::filesystem::path& path);
+
+ private:
+  struct RegionPages {
+    uintptr_t base;
+    size_t page_count;
+    // index of the first page of the region in dirty_
+    size_t first_page;
+    size_t watch_id;
+  };
+
+  // the file and the writes in flight, defined next to the implementation
+  struct Io;
+
+  // waits for the checkpoint in flight and commits it. if any of it fails,
+  // its pages are marked dirty again. returns whether it succeeded
+  bool complete_writes();
+
+  std::vector<RegionPages> regions_;
+  size_t page_count_ = 0;
+
+  mutable std::mutex mutex_;
+  std::vector<bool> dirty_;
+  size_t dirty_count_ = 0;
+
+  std::unique_ptr<Io> io_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,157 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "chrome_trace.hpp"
+
+#include <cstdio>
+
+#include "modules.hpp"
+#include "trace_writer.hpp"
+#include "watch.hpp"
+
+namespace {
+
+// escapes a string for use inside a JSON string literal
+std::string escape(const std::string& text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buffer[8];
+      std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      escaped += buffer;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+datamon::ChromeTraceWriter::ChromeTraceWriter(const std::filesystem::path& path,
+                                              std::vector<Track> tracks,
+                                              bool watch)
+    : watching_(watch),
+      process_id_(static_cast<uint32_t>(GetCurrentProcessId())),
+      file_(path, std::ios::trunc) {
+  if (!(file_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n")) {
+    throw std::runtime_error{"Failed to create trace file."};
+  }
+
+  file_ << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << process_id_
+        << ",\"args\":{\"name\":\"datamon\"}}";
+
+  for (auto& track : tracks) {
+    tracks_.push_back({std::move(track)});
+  }
+
+  // write() attributes the accessing code to modules, possibly from the
+  // exception handler, where the module table can't be built
+  load_modules();
+
+  if (watching_) {
+    for (auto& track : tracks_) {
+      track.watch_id = detail::add_watch(
+          track.track.address, track.track.size,
+          [this](const Event& event) { write(event); }, detail::Trap::guard);
+    }
+  }
+}
+
+datamon::ChromeTraceWriter::~ChromeTraceWriter() {
+  if (watching_) {
+    for (auto& track : tracks_) {
+      detail::remove_watch(track.watch_id, track.track.address,
+                           track.track.size);
+    }
+  }
+
+  std::unique_lock lock{mutex_};
+  file_ << "\n]}\n";
+}
+
+void datamon::ChromeTraceWriter::write(const Event& event) {
+  std::unique_lock lock{mutex_};
+
+  if (threads_.insert(event.thread_id).second) {
+    file_ << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << process_id_
+          << ",\"tid\":" << event.thread_id
+          << ",\"args\":{\"name\":\"thread " << event.thread_id << "\"}}";
+  }
+
+  const uintptr_t data = reinterpret_cast<uintptr_t>(event.data);
+  TrackState* hit = nullptr;
+  for (auto& track : tracks_) {
+    const uintptr_t start = reinterpret_cast<uintptr_t>(track.track.address);
+    if (start <= data && data - start < track.track.size) {
+      hit = &track;
+      break;
+    }
+  }
+
+  // microseconds with nanosecond precision
+  char timestamp[32];
+  std::snprintf(timestamp, sizeof(timestamp), "%llu.%03llu",
+                static_cast<unsigned long long>(event.timestamp / 1000),
+                static_cast<unsigned long long>(event.timestamp % 1000));
+
+  char addresses[96];
+  std::snprintf(addresses, sizeof(addresses),
+                "\"pc\":\"0x%llx\",\"data\":\"0x%llx\"",
+                static_cast<unsigned long long>(
+                    reinterpret_cast<uintptr_t>(event.accessing_address)),
+                static_cast<unsigned long long>(data));
+
+  const std::string name = hit ? escape(hit->track.name) : "access";
+
+  file_ << ",\n{\"name\":\"" << name << (event.read ? " read" : " write")
+        << "\",\"cat\":\"datamon\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+        << timestamp << ",\"pid\":" << process_id_
+        << ",\"tid\":" << event.thread_id << ",\"args\":{" << addresses;
+  if (hit) {
+    file_ << ",\"offset\":"
+          << data - reinterpret_cast<uintptr_t>(hit->track.address);
+  }
+  if (watching_) {
+    // the code address as module and offset, which is comparable across
+    // runs. only meaningful for events of this process
+    const CodeLocation location = locate(event.accessing_address);
+    if (location.module != unknown_module) {
+      auto name = module_names_.find(location.module);
+      if (name == module_names_.end()) {
+        const auto module = datamon::module(location.module);
+        name = module_names_
+                   .emplace(location.module,
+                            escape(module ? module->path.filename().string()
+                                          : std::string{"?"}))
+                   .first;
+      }
+
+      char offset[32];
+      std::snprintf(offset, sizeof(offset), "0x%llx",
+                    static_cast<unsigned long long>(location.offset));
+      file_ << ",\"module\":\"" << name->second << "\",\"module_offset\":\""
+            << offset << "\"";
+    }
+  }
+  file_ << "}}";
+
+  if (hit) {
+    ++(event.read ? hit->reads : hit->writes);
+    file_ << ",\n{\"name\":\"" << name << "\",\"ph\":\"C\",\"ts\":" << timestamp
+          << ",\"pid\":" << process_id_ << ",\"args\":{\"reads\":"
+          << hit->reads << ",\"writes\":" << hit->writes << "}}";
+  }
+}
+
+void datamon::ChromeTraceWriter::convert(const std::filesystem::path& trace,
+                                         const std::filesystem::path& path,
+                                         std::vector<Track> tracks) {
+  ChromeTraceWriter writer{path, std::move(tracks), false};
+  TraceWriter::read_in_order(trace,
+                             [&](const Event& event) { writer.write(event); });
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "event.hpp"
+
+namespace datamon {
+
+//! @brief Writes events as a Chrome JSON trace, which chrome://tracing and the
+//! Perfetto UI load next to CPU profiles. Every access becomes an instant
+//! event on the track of the accessing thread, named after the watched
+//! region it hit, and every region gets a counter track with its running
+//! read and write counts. Events are written as they come, so traces of any
+//! length can be written without holding them in memory.
+//!
+//! Timestamps are steady clock time, which is QueryPerformanceCounter based
+//! and therefore on the same timeline as ETW based profiles.
+class ChromeTraceWriter {
+ public:
+  //! @brief A named region. Accesses to it are labelled with its name.
+  struct Track {
+    std::string name;
+    void* address;
+    size_t size;
+  };
+
+  //! @brief Starts a trace file.
+  //! @param path The JSON file. It is overwritten if it exists.
+  //! @param tracks The regions to name.
+  //! @param watch Whether to watch the regions and write their accesses as
+  //! they happen. Otherwise events are only written through write().
+  ChromeTraceWriter(const std::filesystem::path& path,
+                    std::vector<Track> tracks, bool watch = true);
+  //! @brief Stops watching and completes the file.
+  ~ChromeTraceWriter();
+
+  ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+  ChromeTraceWriter(ChromeTraceWriter&&) = delete;
+  ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+  ChromeTraceWriter& operator=(ChromeTraceWriter&&) = delete;
+
+  //! @brief Writes an event, e.g. one decoded from a TraceWriter file.
+  void write(const Event& event);
+
+  //! @brief Converts a TraceWriter file. The file is only in order per
+  //! thread, so the threads are merged by timestamp as the file is read,
+  //! which keeps the counters accumulating in time order. Only one block per
+  //! thread is held in memory, so traces of any length can be converted.
+  //! @param trace The TraceWriter file.
+  //! @param path The JSON file.
+  //! @param tracks The regions to name.
+  static void convert(const std::filesystem::path& trace,
+                      const std::filesystem::path& path,
+                      std::vector<Track> tracks);
+
+ private:
+  struct TrackState {
+    Track track;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    // the ID of the watch entry in the interval tree
+    size_t watch_id = 0;
+  };
+
+  std::vector<TrackState> tracks_;
+  bool watching_;
+  uint32_t process_id_;
+
+  std::mutex mutex_;
+  std::ofstream file_;
+  // the threads that already have a named track
+  std::unordered_set<uint32_t> threads_;
+  // the file names of the modules seen so far, by module id
+  std::unordered_map<uint32_t, std::string> module_names_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,211 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "contention.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "watch.hpp"
+
+namespace {
+
+std::atomic<uint64_t> next_detector_id = 0;
+
+}  // namespace
+
+datamon::ContentionDetector::ContentionDetector(void* address, size_t size,
+                                                size_t log_capacity)
+    : address_(address),
+      size_(size),
+      log_capacity_(log_capacity),
+      id_(next_detector_id.fetch_add(1, std::memory_order_relaxed)) {
+  watch_id_ = detail::add_watch(
+      address_, size_,
+      [this](const Event& event) {
+        ThreadTable& table = thread_table(event.thread_id);
+
+        const size_t size = table.size.load(std::memory_order_relaxed);
+        if (size == log_capacity_) {
+          table.dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+
+        table.log[size] = {event.timestamp,
+                           reinterpret_cast<uintptr_t>(event.data),
+                           event.read};
+        table.size.store(size + 1, std::memory_order_release);
+      },
+      detail::Trap::guard, context_);
+}
+
+datamon::ContentionDetector::~ContentionDetector() {
+  detail::remove_watch(watch_id_, address_, size_, context_);
+}
+
+datamon::ContentionDetector::ThreadTable&
+datamon::ContentionDetector::thread_table(uint32_t thread_id) {
+  // the tables this thread used last, by detector id. a detector that was
+  // evicted is looked up again under its lock
+  struct CachedTable {
+    uint64_t detector = UINT64_MAX;
+    ThreadTable* table = nullptr;
+  };
+  thread_local std::array<CachedTable, 8> cache;
+  thread_local size_t next_slot = 0;
+
+  for (const CachedTable& cached : cache) {
+    if (cached.detector == id_) {
+      return *cached.table;
+    }
+  }
+
+  ThreadTable* table;
+  {
+    std::unique_lock lock{mutex_};
+    auto& owned = tables_[thread_id];
+    if (!owned) {
+      // first access from this thread, allocate its whole log now
+      owned = std::make_unique<ThreadTable>(log_capacity_);
+    }
+    table = owned.get();
+  }
+
+  cache[next_slot] = {id_, table};
+  next_slot = (next_slot + 1) % cache.size();
+  return *table;
+}
+
+uint64_t datamon::ContentionDetector::dropped() const {
+  std::unique_lock lock{mutex_};
+
+  uint64_t dropped = 0;
+  for (const auto& [thread_id, table] : tables_) {
+    dropped += table->dropped.load(std::memory_order_relaxed);
+  }
+  return dropped;
+}
+
+std::vector<datamon::ContentionDetector::Line>
+datamon::ContentionDetector::report(uint64_t window_ns) const {
+  struct Merged {
+    uint32_t thread_id;
+    Record record;
+  };
+
+  // merge the per-thread logs into a single timeline. the lock only keeps
+  // the set of tables stable, the threads go on logging meanwhile
+  std::vector<Merged> timeline;
+  {
+    std::unique_lock lock{mutex_};
+    for (const auto& [thread_id, table] : tables_) {
+      const size_t size = table->size.load(std::memory_order_acquire);
+      for (size_t i = 0; i < size; ++i) {
+        timeline.push_back({thread_id, table->log[i]});
+      }
+    }
+  }
+
+  std::sort(timeline.begin(), timeline.end(),
+            [](const Merged& a, const Merged& b) {
+              return a.record.timestamp < b.record.timestamp;
+            });
+
+  // the most recent accesses of a thread to a line, parallel to
+  // Line::threads
+  struct Recent {
+    bool accessed = false;
+    bool written = false;
+    uint64_t last_access = 0;
+    uint64_t last_write = 0;
+    uint64_t written_offsets = 0;
+  };
+
+  struct LineState {
+    Line line{};
+    std::vector<Recent> recent;
+  };
+
+  std::unordered_map<uintptr_t, LineState> lines;
+
+  for (const auto& [thread_id, record] : timeline) {
+    const uintptr_t line_address = record.data & ~(cache_line_size - 1);
+    const uint64_t offset_bit = 1ull << (record.data & (cache_line_size - 1));
+
+    LineState& state = lines[line_address];
+    state.line.address = reinterpret_cast<void*>(line_address);
+
+    auto& threads = state.line.threads;
+    size_t index = 0;
+    while (index < threads.size() && threads[index].thread_id != thread_id) {
+      ++index;
+    }
+    if (index == threads.size()) {
+      threads.push_back({thread_id, 0, 0, record.timestamp, 0, 0});
+      state.recent.emplace_back();
+    }
+
+    // a read conflicts with a recent write of another thread, a write
+    // conflicts with any recent access of another thread
+    for (size_t other = 0; other < threads.size(); ++other) {
+      if (other == index) {
+        continue;
+      }
+
+      const Recent& recent = state.recent[other];
+      const bool conflict =
+          record.read ? recent.written &&
+                            record.timestamp - recent.last_write <= window_ns
+                      : recent.accessed &&
+                            record.timestamp - recent.last_access <= window_ns;
+      if (conflict) {
+        ++state.line.conflicts;
+        break;
+      }
+    }
+
+    ThreadAccess& access = threads[index];
+    Recent& recent = state.recent[index];
+
+    access.last_timestamp = record.timestamp;
+    access.offsets |= offset_bit;
+    recent.accessed = true;
+    recent.last_access = record.timestamp;
+
+    if (record.read) {
+      ++access.reads;
+    } else {
+      ++access.writes;
+      recent.written = true;
+      recent.last_write = record.timestamp;
+      recent.written_offsets |= offset_bit;
+    }
+  }
+
+  std::vector<Line> result;
+  for (auto& [line_address, state] : lines) {
+    if (state.line.conflicts == 0) {
+      continue;
+    }
+
+    // it's false sharing if no thread wrote bytes another thread touched
+    auto& threads = state.line.threads;
+    state.line.false_sharing = true;
+    for (size_t i = 0; i < threads.size(); ++i) {
+      for (size_t j = 0; j < threads.size(); ++j) {
+        if (i != j && (state.recent[i].written_offsets & threads[j].offsets)) {
+          state.line.false_sharing = false;
+        }
+      }
+    }
+
+    result.push_back(std::move(state.line));
+  }
+
+  std::sort(result.begin(), result.end(), [](const Line& a, const Line& b) {
+    return a.conflicts > b.conflicts;
+  });
+
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "context.hpp"
+
+namespace datamon {
+
+//! @brief Detects cache lines of watched memory that bounce between threads.
+//! Every access is logged into a table owned by the accessing thread, and
+//! the tables are only merged when a report is requested.
+//!
+//! The detector watches through a context of its own. The handler serializes
+//! the callbacks of a context, so the accesses to one detector are still
+//! logged one at a time, but they never wait for other watches or detectors.
+class ContentionDetector {
+ public:
+  //! @brief The granularity at which accesses are aggregated.
+  static constexpr size_t cache_line_size = 64;
+
+  //! @brief The accesses of a single thread to a cache line.
+  struct ThreadAccess {
+    uint32_t thread_id;
+    uint64_t reads;
+    uint64_t writes;
+    //! Steady clock time of the first and last access, in nanoseconds.
+    //! Together with the counts these give the access rates.
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    //! One bit per byte of the line, set for every byte an access of this
+    //! thread started at.
+    uint64_t offsets;
+  };
+
+  //! @brief A cache line that was accessed by several threads.
+  struct Line {
+    void* address;
+    std::vector<ThreadAccess> threads;
+    //! The number of accesses that hit the line within the window after an
+    //! access of another thread, where at least one of the two was a write.
+    uint64_t conflicts;
+    //! Whether the threads never accessed the same bytes, meaning the
+    //! contention could be removed by moving the data apart.
+    bool false_sharing;
+  };
+
+  //! @brief Starts monitoring a region.
+  //! @param address The start of the region to be monitored.
+  //! @param size The size of the region to be monitored.
+  //! @param log_capacity The maximum number of accesses logged per thread.
+  //! Accesses beyond that are counted as dropped.
+  ContentionDetector(void* address, size_t size,
+                     size_t log_capacity = 1 << 16);
+  ~ContentionDetector();
+
+  ContentionDetector(const ContentionDetector&) = delete;
+  ContentionDetector(ContentionDetector&&) = delete;
+  ContentionDetector& operator=(const ContentionDetector&) = delete;
+  ContentionDetector& operator=(ContentionDetector&&) = delete;
+
+  //! @brief Merges the per-thread tables and returns the contended lines,
+  //! most conflicts first.
+  //! @param window_ns How close in time, in nanoseconds, accesses from
+  //! different threads have to be to count as a conflict.
+  std::vector<Line> report(uint64_t window_ns = 10'000) const;
+
+  //! @brief The number of accesses that did not fit into the logs.
+  uint64_t dropped() const;
+
+ private:
+  struct Record {
+    uint64_t timestamp;
+    uintptr_t data;
+    bool read;
+  };
+
+  // only the owning thread appends to its table. the size publishes the
+  // records before it, so report() can read them while the thread goes on
+  struct ThreadTable {
+    explicit ThreadTable(size_t capacity)
+        : log(std::make_unique<Record[]>(capacity)) {}
+
+    std::unique_ptr<Record[]> log;
+    std::atomic<size_t> size = 0;
+    std::atomic<uint64_t> dropped = 0;
+  };
+
+  // the calling thread's table, created on its first access
+  ThreadTable& thread_table(uint32_t thread_id);
+
+  void* address_;
+  size_t size_;
+  size_t log_capacity_;
+  // tells detectors apart in the threads' caches of their tables
+  uint64_t id_;
+
+  // only taken to add a thread's table and to merge the tables. logging
+  // itself only runs under the lock of context_
+  mutable std::mutex mutex_;
+  std::unordered_map<uint32_t, std::unique_ptr<ThreadTable>> tables_;
+
+  // keeps the logging of this detector from contending with other watches
+  Context context_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
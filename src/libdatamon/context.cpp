@@ -0,0 +1,33 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "context.hpp"
+
+#include "watch.hpp"
+
+datamon::Context::Context(DeliveryPolicy policy)
+    : state_(std::make_unique<detail::ContextState>()) {
+  set_policy(policy);
+}
+
+datamon::Context::~Context() = default;
+
+datamon::Context& datamon::Context::global() {
+  static Context context;
+  return context;
+}
+
+datamon::DeliveryPolicy datamon::Context::policy() const {
+  return {state_->sample_every.load(std::memory_order_relaxed)};
+}
+
+void datamon::Context::set_policy(DeliveryPolicy policy) {
+  state_->sample_every.store(policy.sample_every, std::memory_order_relaxed);
+}
+
+datamon::ContextStats datamon::Context::stats() const {
+  return {state_->faults.load(std::memory_order_relaxed),
+          state_->delivered.load(std::memory_order_relaxed),
+          state_->sampled_out.load(std::memory_order_relaxed)};
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+namespace datamon {
+
+namespace detail {
+struct ContextState;
+}
+
+//! @brief How a context delivers the events of its persistent watches.
+struct DeliveryPolicy {
+  //! Deliver one out of every this many faults. 1 captures everything.
+  uint32_t sample_every = 1;
+};
+
+//! @brief Counters kept by each context.
+struct ContextStats {
+  //! Faults routed to the context.
+  uint64_t faults;
+  //! Faults whose events were delivered to the watches.
+  uint64_t delivered;
+  //! Faults skipped because of the delivery policy.
+  uint64_t sampled_out;
+};
+
+//! @brief An independent set of watches with its own index, lock, statistics
+//! and delivery policy. The exception handler routes each fault only to the
+//! contexts that have watches on the faulting page, so subsystems using
+//! different contexts don't contend on a lock and can sample differently.
+//!
+//! Sampling only thins out the events of persistent watches. One-shot and
+//! protection based watches manage the state of their pages from their
+//! callbacks, so they always run.
+class Context {
+ public:
+  //! @brief Creates a new context. It has to outlive all of its watches.
+  //! @param policy How events are delivered.
+  explicit Context(DeliveryPolicy policy = {});
+  ~Context();
+
+  Context(const Context&) = delete;
+  Context(Context&&) = delete;
+  Context& operator=(const Context&) = delete;
+  Context& operator=(Context&&) = delete;
+
+  //! @brief The context used by everything that isn't given one explicitly.
+  static Context& global();
+
+  //! @brief How events are delivered.
+  DeliveryPolicy policy() const;
+
+  //! @brief Changes how events are delivered. Takes effect with the next
+  //! fault.
+  void set_policy(DeliveryPolicy policy);
+
+  //! @brief The counters of the context.
+  ContextStats stats() const;
+
+  //! @brief The internal state, only meaningful to the library itself.
+  detail::ContextState& state() const { return *state_; }
+
+ private:
+  std::unique_ptr<detail::ContextState> state_;
+};
+
+}  // namespace datamon
\ No newline at end of file
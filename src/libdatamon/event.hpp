@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+namespace datamon {
+
+//! @brief A single intercepted access, as seen by the exception handler.
+struct Event {
+  //! Steady clock time of the access, in nanoseconds.
+  uint64_t timestamp;
+  //! The address of the code that is accessing the data.
+  void* accessing_address;
+  //! The data being read or written.
+  void* data;
+  //! The ID of the thread that accessed the data.
+  uint32_t thread_id;
+  //! Whether the data is being read or written.
+  bool read;
+};
+
+}  // namespace datamon
\ No newline at end of file
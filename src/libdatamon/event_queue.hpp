@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "event.hpp"
+
+namespace datamon {
+
+//! @brief A bounded lock-free queue of events. Any number of threads can push
+//! and pop concurrently, and neither allocates, so it is safe to push from
+//! the exception handler. Each slot carries a sequence number that tells
+//! producers and consumers whether it is free or filled for their lap around
+//! the ring.
+class EventQueue {
+ public:
+  //! @brief Creates a new queue.
+  //! @param capacity The maximum number of queued events, rounded up to a
+  //! power of two.
+  explicit EventQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+
+    mask_ = size - 1;
+    slots_ = std::make_unique<Slot[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  EventQueue(const EventQueue&) = delete;
+  EventQueue& operator=(const EventQueue&) = delete;
+
+  //! @brief Appends an event.
+  //! @return false if the queue is full.
+  bool push(const Event& event) {
+    size_t position = enqueue_position_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[position & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) -
+                                  static_cast<intptr_t>(position);
+      if (difference == 0) {
+        // the slot is free for this lap, try to claim it
+        if (enqueue_position_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        // the consumer hasn't freed the slot from the previous lap yet
+        return false;
+      } else {
+        // another producer claimed the slot, try the next one
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->event = event;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! @brief Removes the oldest event.
+  //! @return false if the queue is empty.
+  bool pop(Event& event) {
+    size_t position = dequeue_position_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[position & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) -
+                                  static_cast<intptr_t>(position + 1);
+      if (difference == 0) {
+        // the slot is filled for this lap, try to claim it
+        if (dequeue_position_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    event = slot->event;
+    // free the slot for the producers' next lap
+    slot->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! @brief Whether the queue is empty. Only a hint while producers are
+  //! active.
+  bool empty() const {
+    const size_t position = dequeue_position_.load(std::memory_order_acquire);
+    return slots_[position & mask_].sequence.load(std::memory_order_acquire) !=
+           position + 1;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Event event;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+
+  // keep producers and consumers off each other's cache lines
+  alignas(64) std::atomic<size_t> enqueue_position_ = 0;
+  alignas(64) std::atomic<size_t> dequeue_position_ = 0;
+};
+
+}  // namespace datamon
\ No newline at end of file
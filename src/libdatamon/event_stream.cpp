@@ -0,0 +1,95 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "event_stream.hpp"
+
+#include "libdatamon.hpp"
+#include "watch.hpp"
+
+datamon::EventStream::EventStream(void* address, size_t size,
+                                  Scheduler scheduler, size_t capacity,
+                                  size_t max_batch)
+    : EventStream(Context::global(), address, size, std::move(scheduler),
+                  capacity, max_batch) {}
+
+datamon::EventStream::EventStream(Context& context, void* address, size_t size,
+                                  Scheduler scheduler, size_t capacity,
+                                  size_t max_batch)
+    : context_(context),
+      address_(address),
+      size_(size),
+      scheduler_(std::move(scheduler)),
+      max_batch_(max_batch),
+      queue_(capacity) {
+  watch_id_ = detail::add_watch(
+      address_, size_,
+      [this](const Event& event) {
+        if (closed_.load(std::memory_order_relaxed)) {
+          return;
+        }
+
+        if (!queue_.push(event)) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+
+        // pairs with the fence in await_suspend, so either the consumer sees
+        // the event or we see the consumer
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // only the first event after the consumer went to sleep schedules it
+        if (void* waiter = waiter_.exchange(nullptr)) {
+          scheduler_(std::coroutine_handle<>::from_address(waiter));
+        }
+      },
+      detail::Trap::guard, context_);
+}
+
+datamon::EventStream::~EventStream() {
+  detail::remove_watch(watch_id_, address_, size_, context_);
+}
+
+void datamon::EventStream::close() {
+  closed_.store(true);
+
+  if (void* waiter = waiter_.exchange(nullptr)) {
+    scheduler_(std::coroutine_handle<>::from_address(waiter));
+  }
+}
+
+bool datamon::EventStream::Awaiter::await_ready() const noexcept {
+  return !stream_.queue_.empty() || stream_.closed_.load();
+}
+
+bool datamon::EventStream::Awaiter::await_suspend(
+    std::coroutine_handle<> handle) noexcept {
+  stream_.waiter_.store(handle.address());
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // an event might have been pushed before the waiter was published. if we
+  // can still take the waiter back, nobody scheduled us, so don't suspend
+  if (!stream_.queue_.empty() || stream_.closed_.load()) {
+    return stream_.waiter_.exchange(nullptr) == nullptr;
+  }
+
+  return true;
+}
+
+std::vector<datamon::Event> datamon::EventStream::Awaiter::await_resume() {
+  std::vector<Event> batch;
+
+  Event event;
+  while (batch.size() < stream_.max_batch_ && stream_.queue_.pop(event)) {
+    batch.push_back(event);
+  }
+
+  return batch;
+}
+
+datamon::EventStream datamon::events(const Datamon& watch,
+                                     EventStream::Scheduler scheduler) {
+  return EventStream{watch.context(), watch.address(), watch.size(),
+                     std::move(scheduler)};
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "context.hpp"
+#include "event.hpp"
+#include "event_queue.hpp"
+
+namespace datamon {
+
+class Datamon;
+
+//! @brief An asynchronous stream of the accesses to a region, consumed with
+//! co_await. The handler pushes events into a lock-free queue and schedules
+//! the waiting coroutine once; by the time the coroutine runs it takes every
+//! event queued so far, so one resumption consumes a whole batch.
+//!
+//! @code
+//! auto stream = datamon::events(dm, [&loop](auto handle) { loop.post(handle); });
+//! while (true) {
+//!   auto batch = co_await stream;
+//!   if (batch.empty()) break;  // closed
+//!   ...
+//! }
+//! @endcode
+class EventStream {
+ public:
+  //! @brief Hands a coroutine that has events to consume to the event loop.
+  //! Called from the exception handler, so it should only enqueue the handle
+  //! and must not touch watched memory.
+  using Scheduler = std::function<void(std::coroutine_handle<>)>;
+
+  //! @brief Starts streaming the accesses to a region.
+  //! @param address The start of the region.
+  //! @param size The size of the region.
+  //! @param scheduler Resumes the consuming coroutine on the event loop.
+  //! @param capacity The maximum number of queued events. Events beyond that
+  //! are counted as dropped.
+  //! @param max_batch The maximum number of events returned per resumption.
+  EventStream(void* address, size_t size, Scheduler scheduler,
+              size_t capacity = 4096, size_t max_batch = 1024);
+
+  //! @brief Starts streaming the accesses to a region in the given context.
+  //! @param context The context to register the watch in. It has to outlive
+  //! the stream.
+  //! @param address The start of the region.
+  //! @param size The size of the region.
+  //! @param scheduler Resumes the consuming coroutine on the event loop.
+  //! @param capacity The maximum number of queued events. Events beyond that
+  //! are counted as dropped.
+  //! @param max_batch The maximum number of events returned per resumption.
+  EventStream(Context& context, void* address, size_t size,
+              Scheduler scheduler, size_t capacity = 4096,
+              size_t max_batch = 1024);
+  ~EventStream();
+
+  EventStream(const EventStream&) = delete;
+  EventStream(EventStream&&) = delete;
+  EventStream& operator=(const EventStream&) = delete;
+  EventStream& operator=(EventStream&&) = delete;
+
+  class Awaiter {
+   public:
+    explicit Awaiter(EventStream& stream) : stream_(stream) {}
+
+    bool await_ready() const noexcept;
+    bool await_suspend(std::coroutine_handle<> handle) noexcept;
+    //! @return The queued events, or an empty batch once the stream is
+    //! closed.
+    std::vector<Event> await_resume();
+
+   private:
+    EventStream& stream_;
+  };
+
+  //! @brief Waits for the next batch of events.
+  Awaiter operator co_await() { return Awaiter{*this}; }
+
+  //! @brief Stops streaming. A waiting coroutine is scheduled and receives an
+  //! empty batch. Has to be called before destroying a stream a coroutine
+  //! may be waiting on.
+  void close();
+
+  //! @brief The number of events that did not fit into the queue.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  Context& context_;
+  void* address_;
+  size_t size_;
+  Scheduler scheduler_;
+  size_t max_batch_;
+
+  EventQueue queue_;
+  std::atomic<void*> waiter_ = nullptr;
+  std::atomic<bool> closed_ = false;
+  std::atomic<uint64_t> dropped_ = 0;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+//! @brief Streams the accesses to the data watched by a Datamon, in the
+//! Datamon's context.
+//! @param watch The Datamon whose data to stream the accesses of.
+//! @param scheduler Resumes the consuming coroutine on the event loop.
+EventStream events(const Datamon& watch, EventStream::Scheduler scheduler);
+
+}  // namespace datamon
\ No newline at end of file
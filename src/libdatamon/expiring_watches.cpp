@@ -0,0 +1,207 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "expiring_watches.hpp"
+
+#include "watch.hpp"
+
+datamon::ExpiringWatches::ExpiringWatches(std::chrono::milliseconds tick)
+    : tick_(tick), start_(std::chrono::steady_clock::now()) {
+  thread_ = std::thread{&ExpiringWatches::run, this};
+}
+
+datamon::ExpiringWatches::~ExpiringWatches() {
+  {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+
+  std::vector<std::unique_ptr<Entry>> entries;
+  for (auto& [handle, entry] : entries_) {
+    entries.push_back(std::move(entry));
+  }
+  entries_.clear();
+  remove_entries(std::move(entries));
+}
+
+uint64_t datamon::ExpiringWatches::add(void* address, size_t size,
+                                       InterceptorFn interceptor,
+                                       Limits limits) {
+  auto entry = std::make_unique<Entry>();
+  entry->address = address;
+  entry->size = size;
+  entry->interceptor = interceptor;
+  entry->max_events = limits.max_events;
+
+  uint64_t handle;
+  {
+    std::unique_lock lock{mutex_};
+    handle = next_handle_++;
+  }
+
+  // register without our lock, the callback takes it
+  Entry* raw_entry = entry.get();
+  raw_entry->watch_id = detail::add_watch(
+      address, size,
+      [this, raw_entry, handle](const Event& event) {
+        if (!raw_entry->max_events) {
+          raw_entry->interceptor(event.accessing_address, event.read,
+                                 event.data);
+          return;
+        }
+
+        const uint64_t count = ++raw_entry->events;
+        if (count > raw_entry->max_events) {
+          // expired, waiting to be removed
+          return;
+        }
+
+        raw_entry->interceptor(event.accessing_address, event.read,
+                               event.data);
+
+        if (count == raw_entry->max_events) {
+          {
+            std::unique_lock lock{mutex_};
+            exhausted_.push_back(handle);
+          }
+          wake_.notify_one();
+        }
+      },
+      detail::Trap::guard);
+
+  {
+    std::unique_lock lock{mutex_};
+    entries_.emplace(handle, std::move(entry));
+
+    // the last event might have come before the entry was in the map, in
+    // which case the background thread didn't find it
+    if (raw_entry->max_events &&
+        raw_entry->events.load() >= raw_entry->max_events) {
+      exhausted_.push_back(handle);
+      wake_.notify_one();
+    }
+
+    if (limits.ttl.count() > 0) {
+      const uint64_t ticks =
+          (limits.ttl + tick_ - std::chrono::nanoseconds{1}) / tick_;
+      schedule({handle, now_tick() + std::max<uint64_t>(ticks, 1)});
+    }
+  }
+
+  return handle;
+}
+
+void datamon::ExpiringWatches::remove(uint64_t handle) {
+  std::vector<std::unique_ptr<Entry>> entries;
+  {
+    std::unique_lock lock{mutex_};
+    auto it = entries_.find(handle);
+    if (it == entries_.end()) {
+      return;
+    }
+    entries.push_back(std::move(it->second));
+    entries_.erase(it);
+  }
+
+  remove_entries(std::move(entries));
+}
+
+size_t datamon::ExpiringWatches::active() const {
+  std::unique_lock lock{mutex_};
+  return entries_.size();
+}
+
+uint64_t datamon::ExpiringWatches::now_tick() const {
+  return static_cast<uint64_t>((std::chrono::steady_clock::now() - start_) /
+                               tick_);
+}
+
+void datamon::ExpiringWatches::schedule(Timer timer) {
+  // the first level whose span reaches the expiry. timers beyond the last
+  // level wait in it and are rescheduled each time it cascades
+  if (timer.expiry <= current_tick_) {
+    timer.expiry = current_tick_ + 1;
+  }
+  const uint64_t delta = timer.expiry - current_tick_;
+
+  size_t level = 0;
+  while (level + 1 < wheel_levels &&
+         delta >= uint64_t{1} << (wheel_bits * (level + 1))) {
+    ++level;
+  }
+
+  const size_t slot = (timer.expiry >> (wheel_bits * level)) & (wheel_size - 1);
+  wheel_[level][slot].push_back(timer);
+}
+
+void datamon::ExpiringWatches::advance(uint64_t tick,
+                                       std::vector<uint64_t>& expired) {
+  while (current_tick_ < tick) {
+    ++current_tick_;
+
+    // whenever a level wraps around, spread the next slot of the level above
+    // over the levels below
+    for (size_t level = 1; level < wheel_levels; ++level) {
+      const uint64_t span = uint64_t{1} << (wheel_bits * level);
+      if (current_tick_ % span != 0) {
+        break;
+      }
+
+      const size_t slot = (current_tick_ >> (wheel_bits * level)) &
+                          (wheel_size - 1);
+      for (const Timer& timer : std::exchange(wheel_[level][slot], {})) {
+        schedule(timer);
+      }
+    }
+
+    auto& due = wheel_[0][current_tick_ & (wheel_size - 1)];
+    for (const Timer& timer : std::exchange(due, {})) {
+      if (timer.expiry <= current_tick_) {
+        expired.push_back(timer.handle);
+      } else {
+        schedule(timer);
+      }
+    }
+  }
+}
+
+void datamon::ExpiringWatches::remove_entries(
+    std::vector<std::unique_ptr<Entry>> entries) {
+  std::vector<detail::WatchRef> watches;
+  for (const auto& entry : entries) {
+    watches.push_back({entry->watch_id, entry->address, entry->size});
+  }
+
+  // once this returns no callback can be using the entries anymore
+  detail::remove_watches(watches);
+}
+
+void datamon::ExpiringWatches::run() {
+  std::unique_lock lock{mutex_};
+  while (!stopping_) {
+    wake_.wait_for(lock, tick_,
+                   [this] { return stopping_ || !exhausted_.empty(); });
+
+    std::vector<uint64_t> expired = std::exchange(exhausted_, {});
+    advance(now_tick(), expired);
+
+    // handles of watches removed early are still on the wheel, skip them
+    std::vector<std::unique_ptr<Entry>> entries;
+    for (uint64_t handle : expired) {
+      auto it = entries_.find(handle);
+      if (it != entries_.end()) {
+        entries.push_back(std::move(it->second));
+        entries_.erase(it);
+      }
+    }
+
+    if (!entries.empty()) {
+      lock.unlock();
+      remove_entries(std::move(entries));
+      lock.lock();
+    }
+  }
+}
\ No newline at end of file
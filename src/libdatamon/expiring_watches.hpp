@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "libdatamon.hpp"
+
+namespace datamon {
+
+//! @brief A set of watches that remove themselves after a time to live or
+//! after a number of events. Expiry times are kept in a hierarchical timer
+//! wheel, and a background thread removes everything that expired during a
+//! tick in one batch, so a rolling set of diagnostic watches costs a single
+//! protection change per tick instead of one per watch.
+class ExpiringWatches {
+ public:
+  //! @brief When a watch expires. Zero means no limit.
+  struct Limits {
+    std::chrono::nanoseconds ttl{0};
+    uint64_t max_events = 0;
+  };
+
+  //! @brief Starts the background thread.
+  //! @param tick The resolution of the time to live.
+  explicit ExpiringWatches(
+      std::chrono::milliseconds tick = std::chrono::milliseconds{10});
+  //! @brief Removes the remaining watches.
+  ~ExpiringWatches();
+
+  ExpiringWatches(const ExpiringWatches&) = delete;
+  ExpiringWatches(ExpiringWatches&&) = delete;
+  ExpiringWatches& operator=(const ExpiringWatches&) = delete;
+  ExpiringWatches& operator=(ExpiringWatches&&) = delete;
+
+  //! @brief Adds a watch.
+  //! @param address The address of the data to be monitored.
+  //! @param size The size of the data to be monitored.
+  //! @param interceptor The interceptor callback function to call when the
+  //! data is accessed.
+  //! @param limits When the watch expires. With max_events, exactly that many
+  //! events are reported.
+  //! @return A handle to remove the watch early with.
+  uint64_t add(void* address, size_t size, InterceptorFn interceptor,
+               Limits limits);
+
+  //! @brief Removes a watch before it expires. Does nothing if it already
+  //! has.
+  void remove(uint64_t handle);
+
+  //! @brief The number of watches that haven't been removed yet.
+  size_t active() const;
+
+ private:
+  struct Entry {
+    void* address;
+    size_t size;
+    InterceptorFn interceptor;
+    uint64_t max_events;
+    std::atomic<uint64_t> events = 0;
+    // the ID of the watch entry in the interval tree
+    size_t watch_id;
+  };
+
+  struct Timer {
+    uint64_t handle;
+    uint64_t expiry;
+  };
+
+  // 64 slots per level, 4 levels cover 2^24 ticks
+  static constexpr int wheel_bits = 6;
+  static constexpr size_t wheel_size = size_t{1} << wheel_bits;
+  static constexpr size_t wheel_levels = 4;
+
+  uint64_t now_tick() const;
+  void schedule(Timer timer);
+  // moves the wheel to the given tick and collects the expired handles
+  void advance(uint64_t tick, std::vector<uint64_t>& expired);
+  // unregisters the given entries in one batch
+  void remove_entries(std::vector<std::unique_ptr<Entry>> entries);
+  void run();
+
+  std::chrono::steady_clock::duration tick_;
+  std::chrono::steady_clock::time_point start_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries_;
+  uint64_t next_handle_ = 1;
+  std::array<std::array<std::vector<Timer>, wheel_size>, wheel_levels> wheel_;
+  uint64_t current_tick_ = 0;
+  // watches that reached their maximum number of events
+  std::vector<uint64_t> exhausted_;
+  bool stopping_ = false;
+  std::condition_variable wake_;
+
+  std::thread thread_;
+};
+
+}  // namespace datamon
\ No newline at end of file
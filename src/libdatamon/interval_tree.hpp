@@ -37,11 +37,23 @@ class IntervalTree {
     if (id_to_node_.find(id) != id_to_node_.end()) {
       TKey key = id_to_node_[id].start;
       root_ = erase(std::move(root_), key, id);
+      id_to_node_.erase(id);
     }
   }
 
+  // returns an id that no interval will get, for entries kept outside of the
+  // tree that share the id space of the intervals
+  size_t reserve_id() { return next_id_++; }
+
   std::vector<Interval> query(TKey point) const { return query(root_, point); }
 
+  // returns all intervals that overlap [start, end]
+  std::vector<Interval> query(TKey start, TKey end) const {
+    std::vector<Interval> result;
+    query(root_, start, end, result);
+    return result;
+  }
+
   bool empty() const { return !root_; }
 
  private:
@@ -173,6 +185,9 @@ class IntervalTree {
     return current;
   }
 
+  // passed as the id to delete a node with all of its intervals
+  static constexpr size_t whole_node = static_cast<size_t>(-1);
+
   std::unique_ptr<Node> erase(std::unique_ptr<Node> root, TKey key, size_t id) {
     // standard BST deletion
     if (root == nullptr) {
@@ -194,14 +209,13 @@ class IntervalTree {
     // if key is same as root's key, then this is the node
     // to be deleted
     else {
-      if (root->intervals.size() > 1) {
+      if (root->intervals.size() > 1 && id != whole_node) {
         // multiple intervals within the same node, just remove the interval
 
         // remove the interval with the given id
         for (int i = 0; i < root->intervals.size(); ++i) {
           if (root->intervals[i].id == id) {
             root->intervals.erase(root->intervals.begin() + i);
-            id_to_node_.erase(id);
             break;
           }
         }
@@ -225,12 +239,13 @@ class IntervalTree {
           // successor (smallest in the right subtree)
           Node* temp = min_value_node(root->right.get());
 
-          // copy the inorder successor's data to this node
-          root->intervals.front() = temp->intervals.front();
+          // copy the inorder successor's data to this node, including the
+          // intervals that share its start point
+          root->intervals = temp->intervals;
 
-          // delete the inorder successor
-          root->right =
-              erase(std::move(root->right), temp->intervals.front().start, id);
+          // delete the inorder successor with all of its intervals
+          root->right = erase(std::move(root->right),
+                              root->intervals.front().start, whole_node);
         }
       }
     }
@@ -315,6 +330,32 @@ class IntervalTree {
     return result;
   }
 
+  void query(const std::unique_ptr<Node>& node, TKey start, TKey end,
+             std::vector<Interval>& result) const {
+    if (node == nullptr) {
+      return;
+    }
+
+    if (node->intervals.front().start <= end) {
+      for (const auto& interval : node->intervals) {
+        if (start <= interval.end) {
+          result.push_back(interval);
+        }
+      }
+    }
+
+    // same as the point query, the left subtree can only contain overlapping
+    // intervals if one of them ends after our start, and the right subtree
+    // only if the current start key does not already lie past our end
+    if (node->left != nullptr && node->left->max_end >= start) {
+      query(node->left, start, end, result);
+    }
+
+    if (node->right != nullptr && node->intervals.front().start <= end) {
+      query(node->right, start, end, result);
+    }
+  }
+
   // keep track of the unique id for each interval
   size_t next_id_ = 0;
   std::unordered_map<size_t, Interval> id_to_node_;
@@ -0,0 +1,216 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "layout_advisor.hpp"
+
+#include <algorithm>
+
+#include "watch.hpp"
+
+namespace {
+
+// fields are assumed to be naturally aligned to their size, up to 8 bytes
+size_t alignment(size_t size) {
+  size_t alignment = 1;
+  while (alignment < 8 && size % (alignment * 2) == 0) {
+    alignment *= 2;
+  }
+  return alignment;
+}
+
+size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool compatible_writers(const std::vector<uint32_t>& a,
+                        const std::vector<uint32_t>& b) {
+  // fields that are only read can go anywhere, written fields only share a
+  // line with fields written by the same threads
+  return a.empty() || b.empty() || a == b;
+}
+
+}  // namespace
+
+datamon::LayoutAdvisor::LayoutAdvisor(void* address, size_t size,
+                                      std::vector<Field> fields,
+                                      uint64_t window_ns)
+    : address_(address), size_(size), window_ns_(window_ns) {
+  for (const auto& field : fields) {
+    stats_.push_back({field, 0, 0, {}});
+    by_offset_.push_back(by_offset_.size());
+  }
+
+  std::sort(by_offset_.begin(), by_offset_.end(), [this](size_t a, size_t b) {
+    return stats_[a].field.offset < stats_[b].field.offset;
+  });
+
+  co_accesses_.resize(stats_.size() * stats_.size());
+
+  watch_id_ = detail::add_watch(
+      address_, size_,
+      [this](const Event& event) {
+        const size_t offset = reinterpret_cast<uintptr_t>(event.data) -
+                              reinterpret_cast<uintptr_t>(address_);
+
+        std::unique_lock lock{mutex_};
+
+        // find the field containing the offset
+        auto it = std::upper_bound(by_offset_.begin(), by_offset_.end(),
+                                   offset, [this](size_t offset, size_t index) {
+                                     return offset < stats_[index].field.offset;
+                                   });
+        if (it == by_offset_.begin()) {
+          return;
+        }
+
+        const size_t index = *(it - 1);
+        FieldStats& stats = stats_[index];
+        if (offset >= stats.field.offset + stats.field.size) {
+          // padding between fields
+          return;
+        }
+
+        if (event.read) {
+          ++stats.reads;
+        } else {
+          ++stats.writes;
+          auto writer = std::lower_bound(stats.writers.begin(),
+                                         stats.writers.end(), event.thread_id);
+          if (writer == stats.writers.end() || *writer != event.thread_id) {
+            stats.writers.insert(writer, event.thread_id);
+          }
+        }
+
+        auto [last, inserted] = last_access_.try_emplace(
+            event.thread_id, LastAccess{index, event.timestamp});
+        if (!inserted) {
+          const size_t previous = last->second.field;
+          if (previous != index &&
+              event.timestamp - last->second.timestamp <= window_ns_) {
+            ++co_accesses_[previous * stats_.size() + index];
+            ++co_accesses_[index * stats_.size() + previous];
+          }
+          last->second = {index, event.timestamp};
+        }
+      },
+      detail::Trap::guard);
+}
+
+datamon::LayoutAdvisor::~LayoutAdvisor() {
+  detail::remove_watch(watch_id_, address_, size_);
+}
+
+uint64_t datamon::LayoutAdvisor::co_accesses(size_t a, size_t b) const {
+  std::unique_lock lock{mutex_};
+  return co_accesses_[a * stats_.size() + b];
+}
+
+datamon::LayoutAdvisor::Report datamon::LayoutAdvisor::report() const {
+  std::unique_lock lock{mutex_};
+
+  const size_t count = stats_.size();
+  auto accesses = [this](size_t index) {
+    return stats_[index].reads + stats_[index].writes;
+  };
+
+  Report report{stats_, {}, 0, 0};
+
+  std::vector<size_t> hot;
+  std::vector<size_t> cold;
+  for (size_t index = 0; index < count; ++index) {
+    (accesses(index) ? hot : cold).push_back(index);
+  }
+
+  // hottest fields first, the rest of the algorithm relies on this order to
+  // break ties
+  std::stable_sort(hot.begin(), hot.end(), [&](size_t a, size_t b) {
+    return accesses(a) > accesses(b);
+  });
+
+  // count the lines the hot fields currently span
+  std::vector<uintptr_t> current_lines;
+  for (size_t index : hot) {
+    const Field& field = stats_[index].field;
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(address_) + field.offset;
+    for (uintptr_t line = start / cache_line_size;
+         line <= (start + field.size - 1) / cache_line_size; ++line) {
+      current_lines.push_back(line);
+    }
+  }
+  std::sort(current_lines.begin(), current_lines.end());
+  report.current_hot_lines =
+      std::unique(current_lines.begin(), current_lines.end()) -
+      current_lines.begin();
+
+  // greedily fill one line at a time: seed it with the hottest field left
+  // and keep adding the compatible field that is co-accessed the most with
+  // what is already in the line
+  std::vector<bool> placed(count);
+  for (size_t seed : hot) {
+    if (placed[seed]) {
+      continue;
+    }
+
+    std::vector<size_t> line{seed};
+    std::vector<uint32_t> writers = stats_[seed].writers;
+    size_t used = stats_[seed].field.size;
+    placed[seed] = true;
+
+    while (true) {
+      size_t best = count;
+      uint64_t best_affinity = 0;
+
+      for (size_t candidate : hot) {
+        const size_t size = stats_[candidate].field.size;
+        if (placed[candidate] ||
+            align_up(used, alignment(size)) + size > cache_line_size ||
+            !compatible_writers(writers, stats_[candidate].writers)) {
+          continue;
+        }
+
+        uint64_t affinity = 0;
+        for (size_t member : line) {
+          affinity += co_accesses_[candidate * count + member];
+        }
+
+        if (best == count || affinity > best_affinity) {
+          best = candidate;
+          best_affinity = affinity;
+        }
+      }
+
+      if (best == count) {
+        break;
+      }
+
+      const size_t size = stats_[best].field.size;
+      used = align_up(used, alignment(size)) + size;
+      if (writers.empty()) {
+        writers = stats_[best].writers;
+      }
+      line.push_back(best);
+      placed[best] = true;
+    }
+
+    // a field larger than a cache line spans several on its own
+    report.proposed_hot_lines += (used + cache_line_size - 1) / cache_line_size;
+    report.lines.push_back(std::move(line));
+  }
+
+  // the cold fields keep their relative order at the end
+  size_t used = cache_line_size;
+  for (size_t index : cold) {
+    const size_t size = stats_[index].field.size;
+    const size_t offset = align_up(used, alignment(size));
+    if (offset + size > cache_line_size && used != 0) {
+      report.lines.emplace_back();
+      used = 0;
+    }
+    report.lines.back().push_back(index);
+    used = align_up(used, alignment(size)) + size;
+  }
+
+  return report;
+}
\ No newline at end of file
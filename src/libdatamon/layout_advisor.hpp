@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Collects per-field access statistics of a struct and proposes a
+//! field order that packs hot, co-accessed fields into the fewest cache
+//! lines while keeping fields written by different threads apart.
+class LayoutAdvisor {
+ public:
+  //! @brief The granularity the proposed layout is packed for.
+  static constexpr size_t cache_line_size = 64;
+
+  //! @brief A field of the watched struct. See DATAMON_FIELD.
+  struct Field {
+    const char* name;
+    size_t offset;
+    size_t size;
+  };
+
+  //! @brief The statistics collected for a field.
+  struct FieldStats {
+    Field field;
+    uint64_t reads;
+    uint64_t writes;
+    //! The IDs of the threads that wrote the field, sorted.
+    std::vector<uint32_t> writers;
+  };
+
+  //! @brief The proposed layout.
+  struct Report {
+    //! The statistics of every field, in the order they were given.
+    std::vector<FieldStats> fields;
+    //! The proposed cache lines, each a list of indices into fields. Fields
+    //! that were never accessed are grouped into the trailing lines.
+    std::vector<std::vector<size_t>> lines;
+    //! The number of cache lines the accessed fields span right now.
+    size_t current_hot_lines;
+    //! The number of cache lines the accessed fields span in the proposal.
+    size_t proposed_hot_lines;
+  };
+
+  //! @brief Starts collecting statistics for a struct.
+  //! @param address The address of the struct.
+  //! @param size The size of the struct.
+  //! @param fields The fields of the struct. They must not overlap.
+  //! @param window_ns How close in time, in nanoseconds, two accesses of the
+  //! same thread to different fields have to be to count as co-accessed.
+  LayoutAdvisor(void* address, size_t size, std::vector<Field> fields,
+                uint64_t window_ns = 1'000);
+  ~LayoutAdvisor();
+
+  LayoutAdvisor(const LayoutAdvisor&) = delete;
+  LayoutAdvisor(LayoutAdvisor&&) = delete;
+  LayoutAdvisor& operator=(const LayoutAdvisor&) = delete;
+  LayoutAdvisor& operator=(LayoutAdvisor&&) = delete;
+
+  //! @brief Returns the statistics collected so far and the layout proposed
+  //! from them.
+  Report report() const;
+
+  //! @brief How often the two fields were accessed back to back by the same
+  //! thread. Indices are in the order the fields were given.
+  uint64_t co_accesses(size_t a, size_t b) const;
+
+ private:
+  struct LastAccess {
+    size_t field;
+    uint64_t timestamp;
+  };
+
+  void* address_;
+  size_t size_;
+  uint64_t window_ns_;
+
+  mutable std::mutex mutex_;
+  std::vector<FieldStats> stats_;
+  // indices into stats_ sorted by field offset, for the lookup in the handler
+  std::vector<size_t> by_offset_;
+  // symmetric matrix of co-access counts
+  std::vector<uint64_t> co_accesses_;
+  std::unordered_map<uint32_t, LastAccess> last_access_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
+
+//! @brief Describes a member of a struct for datamon::LayoutAdvisor.
+#define DATAMON_FIELD(type, member) \
+  datamon::LayoutAdvisor::Field{#member, offsetof(type, member), \
+                                sizeof(type::member)}
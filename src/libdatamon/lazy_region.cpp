@@ -0,0 +1,122 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "lazy_region.hpp"
+
+#include "watch.hpp"
+
+datamon::LazyRegion::LazyRegion(size_t size, FillFn fill, bool writable)
+    : fill_(std::move(fill)), writable_(writable) {
+  const size_t page_size = detail::page_size();
+  size_ = (size + page_size - 1) / page_size * page_size;
+
+  // back the region by the page file so it can be mapped twice
+  const uint64_t section_size = size_;
+  section_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr,
+                                PAGE_READWRITE | SEC_COMMIT,
+                                static_cast<DWORD>(section_size >> 32),
+                                static_cast<DWORD>(section_size), nullptr);
+  if (!section_) {
+    throw std::runtime_error{"Failed to create section."};
+  }
+
+  data_ = MapViewOfFile(section_, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size_);
+  fill_view_ =
+      MapViewOfFile(section_, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size_);
+  if (!data_ || !fill_view_) {
+    if (data_) {
+      UnmapViewOfFile(data_);
+    }
+    if (fill_view_) {
+      UnmapViewOfFile(fill_view_);
+    }
+    CloseHandle(section_);
+    throw std::runtime_error{"Failed to map section."};
+  }
+
+  DWORD old_protection;
+  if (!VirtualProtect(data_, size_, PAGE_NOACCESS, &old_protection)) {
+    UnmapViewOfFile(data_);
+    UnmapViewOfFile(fill_view_);
+    CloseHandle(section_);
+    throw std::runtime_error{"Failed to protect memory."};
+  }
+
+  pages_.resize(size_ / page_size);
+
+  watch_id_ = detail::add_no_access_watch(
+      data_, size_, [this, page_size](const Event& event) {
+        const bool filled =
+            fill_page((reinterpret_cast<uintptr_t>(event.data) -
+                       reinterpret_cast<uintptr_t>(data_)) /
+                      page_size);
+
+        // a write to a read-only region stays an access violation
+        return filled && (event.read || writable_);
+      });
+}
+
+datamon::LazyRegion::~LazyRegion() {
+  detail::remove_watch(watch_id_, data_, size_);
+
+  UnmapViewOfFile(data_);
+  UnmapViewOfFile(fill_view_);
+  CloseHandle(section_);
+}
+
+size_t datamon::LazyRegion::filled_count() const {
+  std::unique_lock lock{mutex_};
+  return filled_count_;
+}
+
+void datamon::LazyRegion::prefetch(size_t offset, size_t size) {
+  const size_t page_size = detail::page_size();
+  const size_t end = std::min(offset + size, size_);
+  for (size_t page = offset / page_size; page * page_size < end; ++page) {
+    if (!fill_page(page)) {
+      throw std::runtime_error{"Failed to protect memory."};
+    }
+  }
+}
+
+bool datamon::LazyRegion::fill_page(size_t page) {
+  {
+    std::unique_lock lock{mutex_};
+
+    // threads that faulted on the page while it was being filled wait for it
+    // to be done, at which point there is nothing left to do
+    page_done_.wait(lock, [&] { return pages_[page] != PageState::filling; });
+    if (pages_[page] == PageState::filled) {
+      return true;
+    }
+
+    pages_[page] = PageState::filling;
+  }
+
+  const size_t page_size = detail::page_size();
+  const size_t offset = page * page_size;
+
+  // the page is ours, so it's filled without the lock while other threads
+  // fill other pages
+  fill_(static_cast<char*>(fill_view_) + offset, offset, page_size);
+
+  // publish the page. if that fails the page is filled again next time
+  DWORD old_protection;
+  const bool published =
+      VirtualProtect(static_cast<char*>(data_) + offset, page_size,
+                     writable_ ? PAGE_READWRITE : PAGE_READONLY,
+                     &old_protection) != FALSE;
+
+  {
+    std::unique_lock lock{mutex_};
+    if (published) {
+      pages_[page] = PageState::filled;
+      ++filled_count_;
+    } else {
+      pages_[page] = PageState::empty;
+    }
+  }
+  page_done_.notify_all();
+  return published;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Memory that is populated on demand, one page at a time. All pages
+//! start out inaccessible; the first access to a page calls the fill
+//! callback for it, after which the page is accessed at full speed.
+//!
+//! The region owns its memory: it is mapped twice, and the fill callback
+//! writes through a private view while the public one stays inaccessible,
+//! so other threads can never observe a partially filled page. Different
+//! pages are filled in parallel; threads touching a page that is being filled
+//! wait for it.
+class LazyRegion {
+ public:
+  //! @brief The type of the fill callback. It is called from the exception
+  //! handler and must not throw.
+  //! @param page Writable memory backing the page to be filled.
+  //! @param offset The offset of the page within the region.
+  //! @param size The size of the page.
+  using FillFn = std::function<void(void* page, size_t offset, size_t size)>;
+
+  //! @brief Creates a new lazily filled region.
+  //! @param size The size of the region, rounded up to whole pages.
+  //! @param fill The callback that populates a page on first access.
+  //! @param writable Whether the pages are writable once filled, or
+  //! read-only.
+  LazyRegion(size_t size, FillFn fill, bool writable = true);
+  ~LazyRegion();
+
+  LazyRegion(const LazyRegion&) = delete;
+  LazyRegion(LazyRegion&&) = delete;
+  LazyRegion& operator=(const LazyRegion&) = delete;
+  LazyRegion& operator=(LazyRegion&&) = delete;
+
+  //! @brief The start of the region.
+  void* data() const { return data_; }
+
+  //! @brief The size of the region.
+  size_t size() const { return size_; }
+
+  //! @brief The number of pages filled so far.
+  size_t filled_count() const;
+
+  //! @brief Fills the pages of a range ahead of the first access, e.g. from a
+  //! background thread warming up the region.
+  //! @param offset The offset of the range within the region.
+  //! @param size The size of the range.
+  void prefetch(size_t offset, size_t size);
+
+ private:
+  enum class PageState : uint8_t {
+    empty,
+    // claimed by a thread that fills it without holding the lock
+    filling,
+    filled,
+  };
+
+  // fills and publishes a page unless it was already, or waits for the thread
+  // filling it. returns whether the page is accessible
+  bool fill_page(size_t page);
+
+  size_t size_;
+  FillFn fill_;
+  bool writable_;
+
+  void* section_;
+  void* data_;
+  void* fill_view_;
+
+  mutable std::mutex mutex_;
+  std::vector<PageState> pages_;
+  size_t filled_count_ = 0;
+  // notified whenever a page stops being filled
+  std::condition_variable page_done_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -4,7 +4,13 @@
 
 #include "libdatamon.hpp"
 
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <utility>
+
 #include "interval_tree.hpp"
+#include "watch.hpp"
 
 size_t veh_refcount = 0;
 HANDLE veh_handle = nullptr;
@@ -14,9 +20,90 @@ std::mutex& veh_mutex() {
   return mutex;
 }
 
-datamon::IntervalTree<datamon::InterceptorFn>& interval_tree() {
-  static datamon::IntervalTree<datamon::InterceptorFn> tree;
-  return tree;
+// where a watch lives, stored for each watch in the routing index
+struct Route {
+  datamon::Context* context;
+  datamon::detail::Trap trap;
+};
+
+// the routing index is split into shards by address, so faults in different
+// parts of memory don't contend on one lock. each shard covers every
+// shard_count-th span of shard_span bytes
+constexpr size_t shard_count = 64;
+constexpr uintptr_t shard_span = 64 * 1024;
+
+struct alignas(64) Shard {
+  // held shared by the handler for as long as it dispatches a fault and
+  // exclusively while watches are added or removed
+  std::shared_mutex mutex;
+  // the ranges of the watches of all contexts that fall into the shard. the
+  // handler looks up the contexts of the faulting page here and then only
+  // locks those
+  datamon::IntervalTree<Route> routes;
+};
+
+std::array<Shard, shard_count>& shards() {
+  static std::array<Shard, shard_count> shards;
+  return shards;
+}
+
+// the shard of an address. a page never straddles two shards
+size_t shard_index(uintptr_t address) {
+  return (address / shard_span) % shard_count;
+}
+
+// the shards the range [start, end] is striped onto, in locking order
+std::vector<size_t> shard_indices(uintptr_t start, uintptr_t end) {
+  std::vector<size_t> indices;
+
+  const uintptr_t first_span = start / shard_span;
+  const uintptr_t last_span = end / shard_span;
+  if (last_span - first_span + 1 >= shard_count) {
+    for (size_t i = 0; i < shard_count; ++i) {
+      indices.push_back(i);
+    }
+    return indices;
+  }
+
+  for (uintptr_t span = first_span; span <= last_span; ++span) {
+    indices.push_back(span % shard_count);
+  }
+  std::sort(indices.begin(), indices.end());
+  return indices;
+}
+
+// the contexts with watches of the given traps in [start, end]
+template <typename TPredicate>
+std::vector<datamon::Context*> contexts_in(const Shard& shard, uintptr_t start,
+                                           uintptr_t end, TPredicate accepts) {
+  std::vector<datamon::Context*> contexts;
+  for (auto& [route_start, route_end, route, id] :
+       shard.routes.query(start, end)) {
+    if (accepts(route.trap) &&
+        std::find(contexts.begin(), contexts.end(), route.context) ==
+            contexts.end()) {
+      contexts.push_back(route.context);
+    }
+  }
+  return contexts;
+}
+
+std::mutex& write_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+struct WriteRef {
+  size_t count;
+  // whether the page was writable when it was first armed. pages that were
+  // read-only to begin with are counted but never made writable
+  bool writable;
+};
+
+// reference counts of the pages armed for write_once watches
+std::unordered_map<uintptr_t, WriteRef>& write_refs() {
+  static std::unordered_map<uintptr_t, WriteRef> refs;
+  return refs;
 }
 
 MEMORY_BASIC_INFORMATION virtual_query(uintptr_t address) {
@@ -34,34 +121,54 @@ void protect_memory(uintptr_t address, size_t size,
   uintptr_t end = address + size;
   while (start < end) {
     MEMORY_BASIC_INFORMATION mbi = virtual_query(start);
+    const uintptr_t region_start =
+        reinterpret_cast<uintptr_t>(mbi.BaseAddress);
     DWORD old_protection = mbi.Protect;
     DWORD new_protection = protection_modifier(old_protection);
     if (old_protection != new_protection) {
-      if (!VirtualProtect(mbi.BaseAddress, std::min(size, mbi.RegionSize),
+      // don't touch the part of the region past the end of the range
+      if (!VirtualProtect(mbi.BaseAddress,
+                          std::min<uintptr_t>(end - region_start,
+                                              mbi.RegionSize),
                           new_protection, &old_protection)) {
         throw std::runtime_error{"Failed to protect memory."};
       }
     }
-    start += mbi.RegionSize;
+    start = region_start + mbi.RegionSize;
   }
 }
 
-// vectored exception handler
-LONG NTAPI handler(PEXCEPTION_POINTERS exception_pointers) {
-  std::unique_lock lock{veh_mutex()};
-
-  if (interval_tree().empty()) {
-    // no interceptors registered, continue search
-    return EXCEPTION_CONTINUE_SEARCH;
+// the protection with write access removed, keeping the modifier flags
+DWORD without_write(DWORD protect) {
+  switch (protect & 0xff) {
+    case PAGE_READWRITE:
+    case PAGE_WRITECOPY:
+      return (protect & ~0xff) | PAGE_READONLY;
+    case PAGE_EXECUTE_READWRITE:
+    case PAGE_EXECUTE_WRITECOPY:
+      return (protect & ~0xff) | PAGE_EXECUTE_READ;
+    default:
+      return protect;
   }
+}
 
-  // store the last data address and restore PAGE_GUARD protection after the
-  // single step (since it gets cleared)
-  thread_local uintptr_t last_data_address = 0;
+// the protection with write access granted, keeping the modifier flags
+DWORD with_write(DWORD protect) {
+  switch (protect & 0xff) {
+    case PAGE_READONLY:
+      return (protect & ~0xff) | PAGE_READWRITE;
+    case PAGE_EXECUTE_READ:
+      return (protect & ~0xff) | PAGE_EXECUTE_READWRITE;
+    default:
+      return protect;
+  }
+}
 
-  if (exception_pointers->ExceptionRecord->ExceptionCode ==
-      STATUS_GUARD_PAGE_VIOLATION) {
-    // page guard, call any interceptors that watch this address
+bool is_writable(uintptr_t address) {
+  const DWORD protect = virtual_query(address).Protect;
+  return with_write(protect) == protect && (protect & 0xff) != PAGE_NOACCESS &&
+         (protect & 0xff) != PAGE_EXECUTE;
+}
 
 #ifdef _WIN64
 #define XIP Rip
@@ -69,53 +176,313 @@ LONG NTAPI handler(PEXCEPTION_POINTERS exception_pointers) {
 #define XIP Eip
 #endif
 
-    // address of code that caused the exception
-    void* accessing_address =
-        reinterpret_cast<void*>(exception_pointers->ContextRecord->XIP);
+// steady clock time in nanoseconds
+uint64_t timestamp() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
 
-    bool read =
-        exception_pointers->ExceptionRecord->ExceptionInformation[0] == 0;
+// builds the event for an access violation or guard page violation
+datamon::Event make_event(PEXCEPTION_POINTERS exception_pointers) {
+  return {
+      timestamp(),
+      // address of code that caused the exception
+      reinterpret_cast<void*>(exception_pointers->ContextRecord->XIP),
+      // address of the data being read or written
+      reinterpret_cast<void*>(
+          exception_pointers->ExceptionRecord->ExceptionInformation[1]),
+      static_cast<uint32_t>(GetCurrentThreadId()),
+      exception_pointers->ExceptionRecord->ExceptionInformation[0] == 0,
+  };
+}
+
+// whether a watch's filters let an access through. the caller holds the
+// context's lock
+bool accepts(const datamon::detail::ContextState& state, size_t id,
+             const datamon::Event& event, uint64_t thread_tags) {
+  if (state.filters.empty()) {
+    return true;
+  }
+
+  auto filters = state.filters.find(id);
+  if (filters == state.filters.end()) {
+    return true;
+  }
+
+  const auto& [code, threads] = filters->second;
+  return (!code || code->accepts(event.accessing_address)) &&
+         (!threads || threads->accepts(event.thread_id, thread_tags));
+}
+
+bool is_guard(datamon::detail::Trap trap) {
+  return trap == datamon::detail::Trap::guard ||
+         trap == datamon::detail::Trap::guard_once;
+}
+
+// vectored exception handler
+LONG NTAPI handler(PEXCEPTION_POINTERS exception_pointers) {
+  // store the last data address and restore PAGE_GUARD protection after the
+  // single step (since it gets cleared)
+  thread_local uintptr_t last_data_address = 0;
+  // the post-write callbacks of the watches hit by the stepped instruction
+  thread_local std::vector<std::pair<datamon::detail::StepFn, datamon::Event>>
+      after_write;
+
+  const DWORD code = exception_pointers->ExceptionRecord->ExceptionCode;
+
+  if (last_data_address && code == STATUS_SINGLE_STEP) {
+    // the write has landed but the page isn't guarded yet, so the callbacks
+    // can read it without faulting
+    for (auto& [fn, event] : std::exchange(after_write, {})) {
+      fn(event);
+    }
+
+    Shard& shard = shards()[shard_index(last_data_address)];
+    std::shared_lock shard_lock{shard.mutex};
+
+    // restore PAGE_GUARD protection, unless the watch was removed in the
+    // meantime
+    const uintptr_t page =
+        last_data_address & ~(datamon::detail::page_size() - 1);
+    if (!contexts_in(shard, page, page + datamon::detail::page_size() - 1,
+                     [](datamon::detail::Trap trap) {
+                       return trap == datamon::detail::Trap::guard;
+                     })
+             .empty()) {
+      protect_memory(last_data_address, 1,
+                     [](DWORD protect) { return protect | PAGE_GUARD; });
+    }
+
+    last_data_address = 0;
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+  }
+
+  if (code != STATUS_GUARD_PAGE_VIOLATION &&
+      code != EXCEPTION_ACCESS_VIOLATION) {
+    return EXCEPTION_CONTINUE_SEARCH;
+  }
+
+  // every watch that can be hit by the fault is routed through the shard of
+  // the data address
+  Shard& shard = shards()[shard_index(static_cast<uintptr_t>(
+      exception_pointers->ExceptionRecord->ExceptionInformation[1]))];
+  std::shared_lock shard_lock{shard.mutex};
+
+  if (shard.routes.empty()) {
+    // no interceptors registered, continue search
+    return EXCEPTION_CONTINUE_SEARCH;
+  }
+
+  if (code == STATUS_GUARD_PAGE_VIOLATION) {
+    // page guard, call any interceptors that watch this address
 
     // address of the data being read or written
     uintptr_t data_address = static_cast<uintptr_t>(
         exception_pointers->ExceptionRecord->ExceptionInformation[1]);
 
+    // read up front, the thread filters compare against it for every watch
+    const uint64_t thread_tags = datamon::thread_tags();
+
+    // the guard is cleared on the whole page that was hit, so look at every
+    // watch on that page and not only the ones containing the data address
+    const uintptr_t page = data_address & ~(datamon::detail::page_size() - 1);
+    const auto contexts =
+        contexts_in(shard, page, page + datamon::detail::page_size() - 1,
+                    is_guard);
+
+    if (contexts.empty()) {
+      // not one of our guard pages
+      return EXCEPTION_CONTINUE_SEARCH;
+    }
+
     // TODO: maybe here we could infer what value is being attempted to be
     // written by disassembling the code that caused the exception
 
-    // call all interceptors that watch this address
-    auto interceptors = interval_tree().query(data_address);
-    for (auto& [start, end, interceptor, id] : interceptors) {
-      interceptor(accessing_address, read,
-                  reinterpret_cast<void*>(data_address));
+    const datamon::Event event = make_event(exception_pointers);
+
+    bool rearm = false;
+    for (datamon::Context* context : contexts) {
+      auto& state = context->state();
+
+      if (!state.may_accept(thread_tags)) {
+        // none of the context's watches report this thread, only find out
+        // whether its guard has to be restored
+        const uintptr_t last = page + datamon::detail::page_size() - 1;
+        for (const auto& route : shard.routes.query(page, last)) {
+          rearm |= route.value.context == context &&
+                   route.value.trap == datamon::detail::Trap::guard;
+        }
+        continue;
+      }
+
+      std::unique_lock lock{state.mutex};
+
+      auto watches =
+          state.tree.query(page, page + datamon::detail::page_size() - 1);
+
+      std::erase_if(watches, [&state](const auto& interval) {
+        return !is_guard(interval.value.trap) ||
+               state.paused.contains(interval.id);
+      });
+
+      bool hit = false;
+      bool persistent = false;
+      for (auto& [start, end, watch, id] : watches) {
+        hit |= start <= data_address && data_address <= end;
+        persistent |= watch.trap == datamon::detail::Trap::guard;
+      }
+      rearm |= persistent;
+
+      if (!hit) {
+        continue;
+      }
+
+      const bool deliver = state.sample(persistent);
+
+      // call all interceptors that watch this address. one-shot watches are
+      // never sampled out since they only get to see the page once
+      for (auto& [start, end, watch, id] : watches) {
+        if (start <= data_address && data_address <= end) {
+          if ((deliver || watch.trap != datamon::detail::Trap::guard) &&
+              accepts(state, id, event, thread_tags)) {
+            watch.fn(event);
+          }
+          if (watch.after_write && !event.read) {
+            after_write.emplace_back(std::move(watch.after_write), event);
+          }
+        }
+      }
     }
 
-    // set the single step flag to capture the next instruction
-    exception_pointers->ContextRecord->EFlags |= 0x100;
+    if (rearm) {
+      // set the single step flag to capture the next instruction
+      exception_pointers->ContextRecord->EFlags |= 0x100;
 
-    last_data_address = data_address;
+      last_data_address = data_address;
+    }
 
     return EXCEPTION_CONTINUE_EXECUTION;
-  } else if (last_data_address &&
-             exception_pointers->ExceptionRecord->ExceptionCode ==
-                 STATUS_SINGLE_STEP) {
-    // restore PAGE_GUARD protection
-    protect_memory(last_data_address, 1,
-                   [](DWORD protect) { return protect | PAGE_GUARD; });
+  } else {
+    uintptr_t data_address = static_cast<uintptr_t>(
+        exception_pointers->ExceptionRecord->ExceptionInformation[1]);
 
-    last_data_address = 0;
+    if (exception_pointers->ExceptionRecord->ExceptionInformation[0] == 1) {
+      // write to a page armed for write_once watches. the page is disarmed
+      // for all of them at once, so all of them are told about the write
+      const uintptr_t page =
+          data_address & ~(datamon::detail::page_size() - 1);
+      const auto contexts = contexts_in(
+          shard, page, page + datamon::detail::page_size() - 1,
+          [](datamon::detail::Trap trap) {
+            return trap == datamon::detail::Trap::write_once;
+          });
 
-    return EXCEPTION_CONTINUE_EXECUTION;
-  }
+      if (!contexts.empty()) {
+        bool armed;
+        {
+          std::unique_lock write_lock{write_mutex()};
+          auto it = write_refs().find(page);
+          if (it != write_refs().end() && !it->second.writable) {
+            // the page is read-only in its own right
+            return EXCEPTION_CONTINUE_SEARCH;
+          }
+          armed = it != write_refs().end();
+        }
+
+        if (!armed) {
+          // another thread faulted on the same page and the page was lifted
+          // while we were waiting for the lock, just retry the write
+          return is_writable(data_address) ? EXCEPTION_CONTINUE_EXECUTION
+                                           : EXCEPTION_CONTINUE_SEARCH;
+        }
+
+        const datamon::Event event = make_event(exception_pointers);
+
+        for (datamon::Context* context : contexts) {
+          auto& state = context->state();
+          std::unique_lock lock{state.mutex};
+
+          auto watches =
+              state.tree.query(page, page + datamon::detail::page_size() - 1);
+
+          std::erase_if(watches, [](const auto& interval) {
+            return interval.value.trap != datamon::detail::Trap::write_once;
+          });
+
+          state.sample(false);
+          for (auto& [start, end, watch, id] : watches) {
+            watch.fn(event);
+          }
+        }
+
+        // only let the write through once every watch is done with the page
+        std::unique_lock write_lock{write_mutex()};
+        if (write_refs().erase(page)) {
+          protect_memory(page, datamon::detail::page_size(), with_write);
+        }
+
+        return EXCEPTION_CONTINUE_EXECUTION;
+      }
+    }
+
+    // access to a page whose protection was lowered by its owner. the owner
+    // lifts the protection from its callback and the access is retried, unless
+    // none of them could handle it
+    const auto contexts = contexts_in(
+        shard, data_address, data_address, [](datamon::detail::Trap trap) {
+          return trap == datamon::detail::Trap::no_access;
+        });
+
+    if (contexts.empty()) {
+      // a genuine access violation
+      return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    const datamon::Event event = make_event(exception_pointers);
+
+    bool handled = false;
+    std::vector<datamon::detail::FaultFn> faults;
+    for (datamon::Context* context : contexts) {
+      auto& state = context->state();
+      std::unique_lock lock{state.mutex};
+
+      auto watches = state.tree.query(data_address);
+
+      std::erase_if(watches, [](const auto& interval) {
+        return interval.value.trap != datamon::detail::Trap::no_access;
+      });
+
+      state.sample(false);
+      for (auto& [start, end, watch, id] : watches) {
+        if (watch.fault) {
+          faults.push_back(std::move(watch.fault));
+        } else {
+          watch.fn(event);
+          handled = true;
+        }
+      }
+    }
 
-  return EXCEPTION_CONTINUE_SEARCH;
+    // the owners populate the page from their callbacks, which may take a
+    // while, so they run without the context locks and faults on other pages
+    // are handled meanwhile. the shard lock keeps the watches registered
+    for (const auto& fault : faults) {
+      handled |= fault(event);
+    }
+
+    // e.g. a write to a page its owner only made readable
+    return handled ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+  }
 }
 
-datamon::Datamon::Datamon(void* address, size_t size, InterceptorFn interceptor)
-    : address_(address), size_(size), interceptor_(interceptor) {
+// installs the exception handler for the first watch
+void acquire_handler() {
   std::unique_lock lock{veh_mutex()};
 
-  // if this is the first time we instantiated datamon, create the veh handler
+  // if this is the first watch, create the veh handler
   if (veh_refcount == 0) {
     // create the handler
     if (veh_handle = AddVectoredExceptionHandler(1, &handler); !veh_handle) {
@@ -124,30 +491,12 @@ datamon::Datamon::Datamon(void* address, size_t size, InterceptorFn interceptor)
   }
 
   ++veh_refcount;
-
-  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address_);
-
-  // add the interceptor function to the interval tree
-  interceptor_entry_id_ = interval_tree().insert(
-      {address_value, address_value + size_, interceptor_});
-
-  // set the memory protection
-  protect_memory(address_value, size_,
-                 [](DWORD protect) { return protect | PAGE_GUARD; });
 }
 
-datamon::Datamon::~Datamon() {
+// removes the exception handler after the last watch
+void release_handler() {
   std::unique_lock lock{veh_mutex()};
 
-  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address_);
-
-  // restore the memory protection
-  protect_memory(address_value, size_,
-                 [](DWORD protect) { return protect & ~PAGE_GUARD; });
-
-  // erase the interceptor function from the interval tree
-  interval_tree().erase(interceptor_entry_id_);
-
   --veh_refcount;
 
   // if we are done with the veh handler, dispose it
@@ -158,4 +507,645 @@ datamon::Datamon::~Datamon() {
     }
     veh_handle = nullptr;
   }
+}
+
+// summarizes the tags the thread filters of a context's watches require. the
+// caller holds the context's lock
+void update_required_tags(datamon::detail::ContextState& state) {
+  uint64_t required = 0;
+  size_t filtered = 0;
+  for (const auto& [id, filters] : state.filters) {
+    if (filters.threads && state.routes.contains(id)) {
+      required |= filters.threads->required_tags();
+      ++filtered;
+    }
+  }
+
+  // every watch is in the routes, a watch without a thread filter accepts
+  // every thread
+  if (filtered < state.routes.size()) {
+    required = ~uint64_t{0};
+  }
+  state.required_tags.store(required, std::memory_order_relaxed);
+}
+
+// erases a watch from the interval trees. the caller holds the watch's shards
+// exclusively and the context's lock
+void unregister_watch(datamon::detail::ContextState& state, size_t id) {
+  auto watch_routes = state.routes.find(id);
+  for (auto [index, route_id] : watch_routes->second) {
+    shards()[index].routes.erase(route_id);
+  }
+  state.routes.erase(watch_routes);
+  state.filters.erase(id);
+  state.paused.erase(id);
+  state.tree.erase(id);
+  update_required_tags(state);
+}
+
+// inserts the routes of a watch into every shard its range is striped onto.
+// the caller holds those shards exclusively and the context's lock
+void add_routes(datamon::Context& context, size_t id, uintptr_t start,
+                uintptr_t last, datamon::detail::Trap trap) {
+  auto& watch_routes = context.state().routes[id];
+  for (size_t index : shard_indices(start, last)) {
+    watch_routes.emplace_back(
+        index, shards()[index].routes.insert({start, last, {&context, trap}}));
+  }
+  update_required_tags(context.state());
+}
+
+// the [start, last] ranges of watches
+std::vector<std::pair<uintptr_t, uintptr_t>> ranges_of(
+    const std::vector<datamon::detail::WatchRef>& watches) {
+  std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+  for (const auto& watch : watches) {
+    const uintptr_t address_value = reinterpret_cast<uintptr_t>(watch.address);
+    ranges.emplace_back(address_value, address_value + watch.size - 1);
+  }
+  return ranges;
+}
+
+// the shards several [start, last] ranges are striped onto, in locking order
+std::vector<size_t> shard_indices(
+    const std::vector<std::pair<uintptr_t, uintptr_t>>& ranges) {
+  std::vector<size_t> indices;
+  for (auto [start, last] : ranges) {
+    for (size_t index : shard_indices(start, last)) {
+      indices.push_back(index);
+    }
+  }
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  return indices;
+}
+
+// exclusively locks the given shards, which have to be in locking order
+std::vector<std::unique_lock<std::shared_mutex>> lock_shards(
+    const std::vector<size_t>& indices) {
+  std::vector<std::unique_lock<std::shared_mutex>> shard_locks;
+  for (size_t index : indices) {
+    shard_locks.emplace_back(shards()[index].mutex);
+  }
+  return shard_locks;
+}
+
+// the shards and the context lock held while coalesced watches change
+struct CoalescingLocks {
+  std::vector<std::unique_lock<std::shared_mutex>> shards;
+  std::unique_lock<std::mutex> context;
+};
+
+// locks the shards of the ranges and then the context. the entries of
+// coalesced watches can span more shards than the watches themselves, and
+// which ones is only known under the context's lock, so the needed ranges
+// are asked for once it's held and everything is relocked until the shards
+// cover them
+CoalescingLocks lock_covering(
+    datamon::Context& context,
+    const std::vector<std::pair<uintptr_t, uintptr_t>>& ranges,
+    const std::function<std::vector<std::pair<uintptr_t, uintptr_t>>(
+        const datamon::detail::ContextState&)>& needed) {
+  auto& state = context.state();
+
+  std::vector<size_t> indices = shard_indices(ranges);
+  while (true) {
+    CoalescingLocks locks{lock_shards(indices),
+                          std::unique_lock{state.mutex}};
+
+    const std::vector<size_t> needed_indices = shard_indices(needed(state));
+    if (std::includes(indices.begin(), indices.end(), needed_indices.begin(),
+                      needed_indices.end())) {
+      return locks;
+    }
+
+    std::vector<size_t> merged;
+    std::set_union(indices.begin(), indices.end(), needed_indices.begin(),
+                   needed_indices.end(), std::back_inserter(merged));
+    indices = std::move(merged);
+  }
+}
+
+// inserts the entries of coalesced watches of one interceptor, one per run of
+// adjacent or overlapping watches. the caller holds the shards of the
+// watches exclusively and the context's lock
+void insert_coalesced(datamon::Context& context,
+                      datamon::InterceptorFn interceptor,
+                      std::vector<size_t> members) {
+  auto& state = context.state();
+
+  std::sort(members.begin(), members.end(), [&state](size_t a, size_t b) {
+    return state.coalesced.at(a).start < state.coalesced.at(b).start;
+  });
+
+  size_t i = 0;
+  while (i < members.size()) {
+    const size_t first = i;
+    uintptr_t start = state.coalesced.at(members[i]).start;
+    uintptr_t last = state.coalesced.at(members[i]).last;
+    while (++i < members.size() &&
+           state.coalesced.at(members[i]).start <= last + 1) {
+      last = std::max(last, state.coalesced.at(members[i]).last);
+    }
+
+    const size_t node = state.tree.insert(
+        {start,
+         last,
+         {[interceptor](const datamon::Event& event) {
+            interceptor(event.accessing_address, event.read, event.data);
+          },
+          datamon::detail::Trap::guard}});
+    add_routes(context, node, start, last, datamon::detail::Trap::guard);
+
+    std::vector<size_t> node_members{members.begin() + first,
+                                     members.begin() + i};
+    for (size_t member : node_members) {
+      state.coalesced.at(member).node = node;
+    }
+    state.nodes.emplace(node, datamon::detail::CoalescedNode{
+                                  start, last, interceptor,
+                                  std::move(node_members)});
+  }
+}
+
+// the trap of a registered watch. the caller holds the context's lock
+datamon::detail::Trap trap_of(const datamon::detail::ContextState& state,
+                              const datamon::detail::WatchRef& watch) {
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(watch.address);
+  for (const auto& interval :
+       state.tree.query(address_value, address_value + watch.size - 1)) {
+    if (interval.id == watch.id) {
+      return interval.value.trap;
+    }
+  }
+  throw std::runtime_error{"Unknown watch."};
+}
+
+// lifts the guard from the pages of the given [start, end) ranges, except
+// from pages that still have guard routes. the caller holds the shards of the
+// ranges exclusively. runs of adjacent pages take one protection change
+void disarm_guards(std::vector<std::pair<uintptr_t, uintptr_t>> ranges) {
+  const size_t page_size = datamon::detail::page_size();
+
+  uintptr_t run_start = 0;
+  uintptr_t run_end = 0;
+  auto flush = [&] {
+    if (run_start != run_end) {
+      protect_memory(run_start, run_end - run_start,
+                     [](DWORD protect) { return protect & ~PAGE_GUARD; });
+    }
+    run_start = run_end = 0;
+  };
+
+  std::sort(ranges.begin(), ranges.end());
+
+  // the first page that hasn't been looked at yet, overlapping ranges share
+  // pages
+  uintptr_t next = 0;
+  for (auto [start, end] : ranges) {
+    for (uintptr_t page = std::max(start & ~(page_size - 1), next); page < end;
+         page += page_size) {
+      next = page + page_size;
+
+      if (!contexts_in(shards()[shard_index(page)], page, page + page_size - 1,
+                       is_guard)
+               .empty()) {
+        // another watch still guards the page
+        flush();
+        continue;
+      }
+
+      if (run_end != page) {
+        flush();
+        run_start = page;
+      }
+      run_end = page + page_size;
+    }
+  }
+
+  flush();
+}
+
+size_t datamon::detail::page_size() {
+  static const size_t size = [] {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return static_cast<size_t>(info.dwPageSize);
+  }();
+  return size;
+}
+
+// registers a watch and arms its pages, unless the trap leaves that to the
+// owner
+size_t insert_watch(void* address, size_t size, datamon::detail::Watch watch,
+                    datamon::Context& context) {
+  acquire_handler();
+
+  const datamon::detail::Trap trap = watch.trap;
+
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address);
+  const uintptr_t last = address_value + size - 1;
+
+  // register the watch in every shard its range is striped onto. faults are
+  // not dispatched through those shards while we hold them
+  std::vector<std::unique_lock<std::shared_mutex>> shard_locks;
+  for (size_t index : shard_indices(address_value, last)) {
+    shard_locks.emplace_back(shards()[index].mutex);
+  }
+
+  auto& state = context.state();
+  std::unique_lock lock{state.mutex};
+
+  // add the watch to the interval trees. interval end points are inclusive
+  size_t id = state.tree.insert({address_value, last, std::move(watch)});
+
+  add_routes(context, id, address_value, last, trap);
+
+  // set the memory protection. pages of other traps are protected by the
+  // owner of the watch
+  if (is_guard(trap)) {
+    try {
+      protect_memory(address_value, size,
+                     [](DWORD protect) { return protect | PAGE_GUARD; });
+    } catch (...) {
+      // e.g. the range isn't mapped, don't leave the watch behind
+      unregister_watch(state, id);
+      lock.unlock();
+      shard_locks.clear();
+      release_handler();
+      throw;
+    }
+  }
+
+  return id;
+}
+
+size_t datamon::detail::add_watch(void* address, size_t size, WatchFn fn,
+                                  Trap trap, Context& context,
+                                  StepFn after_write) {
+  return insert_watch(address, size,
+                      {std::move(fn), trap, std::move(after_write)}, context);
+}
+
+size_t datamon::detail::add_no_access_watch(void* address, size_t size,
+                                            FaultFn fn, Context& context) {
+  return insert_watch(address, size, {{}, Trap::no_access, {}, std::move(fn)},
+                      context);
+}
+
+size_t datamon::detail::add_coalesced_watch(void* address, size_t size,
+                                            InterceptorFn interceptor,
+                                            Context& context) {
+  acquire_handler();
+
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address);
+  const uintptr_t last = address_value + size - 1;
+
+  // the entries of the same interceptor the watch overlaps or borders on.
+  // they are never adjacent to each other, so they all merge into one
+  auto neighbors = [=](const ContextState& state) {
+    std::vector<size_t> ids;
+    for (const auto& interval :
+         state.tree.query(address_value ? address_value - 1 : 0, last + 1)) {
+      auto node = state.nodes.find(interval.id);
+      if (node != state.nodes.end() &&
+          node->second.interceptor == interceptor) {
+        ids.push_back(interval.id);
+      }
+    }
+    return ids;
+  };
+
+  auto locks = lock_covering(
+      context, {{address_value, last}}, [&](const ContextState& state) {
+        std::vector<std::pair<uintptr_t, uintptr_t>> ranges{
+            {address_value, last}};
+        for (size_t id : neighbors(state)) {
+          const auto& node = state.nodes.at(id);
+          ranges.emplace_back(node.start, node.last);
+        }
+        return ranges;
+      });
+
+  auto& state = context.state();
+
+  // the neighbors' pages are armed already. faults wait for the shards until
+  // the entry is in place
+  try {
+    protect_memory(address_value, size,
+                   [](DWORD protect) { return protect | PAGE_GUARD; });
+  } catch (...) {
+    locks.context.unlock();
+    locks.shards.clear();
+    release_handler();
+    throw;
+  }
+
+  const size_t id = state.tree.reserve_id();
+  state.coalesced.emplace(id, CoalescedWatch{address_value, last, 0});
+
+  std::vector<size_t> members{id};
+  for (size_t node : neighbors(state)) {
+    auto& merged = state.nodes.at(node).members;
+    members.insert(members.end(), merged.begin(), merged.end());
+    state.nodes.erase(node);
+    unregister_watch(state, node);
+  }
+
+  insert_coalesced(context, interceptor, std::move(members));
+
+  return id;
+}
+
+void datamon::detail::remove_watch(size_t id, void* address, size_t size,
+                                   Context& context) {
+  remove_watches({{id, address, size}}, context);
+}
+
+void datamon::detail::remove_watches(const std::vector<WatchRef>& watches,
+                                     Context& context) {
+  if (watches.empty()) {
+    return;
+  }
+
+  {
+    // coalesced watches are split out of their entries, which may reach
+    // beyond the watches
+    auto locks = lock_covering(
+        context, ranges_of(watches), [&watches](const ContextState& state) {
+          auto ranges = ranges_of(watches);
+          for (const WatchRef& watch : watches) {
+            if (auto member = state.coalesced.find(watch.id);
+                member != state.coalesced.end()) {
+              const auto& node = state.nodes.at(member->second.node);
+              ranges.emplace_back(node.start, node.last);
+            }
+          }
+          return ranges;
+        });
+
+    auto& state = context.state();
+
+    // only guard watches own their pages' protection, the others must not
+    // lift a guard set by someone else. paused watches are disarmed already
+    std::vector<std::pair<uintptr_t, uintptr_t>> guarded;
+    // the entries that lose coalesced watches
+    std::vector<size_t> split;
+    for (const WatchRef& watch : watches) {
+      const uintptr_t address_value =
+          reinterpret_cast<uintptr_t>(watch.address);
+
+      if (auto member = state.coalesced.find(watch.id);
+          member != state.coalesced.end()) {
+        std::erase(state.nodes.at(member->second.node).members, watch.id);
+        split.push_back(member->second.node);
+        state.coalesced.erase(member);
+        guarded.emplace_back(address_value, address_value + watch.size);
+        continue;
+      }
+
+      if (is_guard(trap_of(state, watch)) && !state.paused.contains(watch.id)) {
+        guarded.emplace_back(address_value, address_value + watch.size);
+      }
+      unregister_watch(state, watch.id);
+    }
+
+    // the remaining watches of those entries may not be adjacent anymore
+    std::sort(split.begin(), split.end());
+    split.erase(std::unique(split.begin(), split.end()), split.end());
+    for (size_t id : split) {
+      CoalescedNode node = std::move(state.nodes.at(id));
+      state.nodes.erase(id);
+      unregister_watch(state, id);
+      insert_coalesced(context, node.interceptor, std::move(node.members));
+    }
+
+    // restore the memory protection of the pages no other watch guards
+    disarm_guards(std::move(guarded));
+  }
+
+  for (size_t i = 0; i < watches.size(); ++i) {
+    release_handler();
+  }
+}
+
+void datamon::detail::pause_watches(const std::vector<WatchRef>& watches,
+                                    Context& context) {
+  // faults on the watches' pages wait for the shards, so they see either all
+  // of the watches or none of them
+  auto shard_locks = lock_shards(shard_indices(ranges_of(watches)));
+
+  auto& state = context.state();
+  std::unique_lock lock{state.mutex};
+
+  std::vector<std::pair<uintptr_t, uintptr_t>> guarded;
+  for (const WatchRef& watch : watches) {
+    if (!state.paused.insert(watch.id).second) {
+      continue;
+    }
+
+    // without routes the handler and dispatch don't see the watch anymore
+    auto& watch_routes = state.routes[watch.id];
+    for (auto [index, route_id] : watch_routes) {
+      shards()[index].routes.erase(route_id);
+    }
+    watch_routes.clear();
+
+    if (trap_of(state, watch) == Trap::guard) {
+      const uintptr_t address_value =
+          reinterpret_cast<uintptr_t>(watch.address);
+      guarded.emplace_back(address_value, address_value + watch.size);
+    }
+  }
+
+  disarm_guards(std::move(guarded));
+}
+
+void datamon::detail::resume_watches(const std::vector<WatchRef>& watches,
+                                     Context& context) {
+  auto shard_locks = lock_shards(shard_indices(ranges_of(watches)));
+
+  auto& state = context.state();
+  std::unique_lock lock{state.mutex};
+
+  std::vector<std::pair<uintptr_t, uintptr_t>> guarded;
+  for (const WatchRef& watch : watches) {
+    if (!state.paused.erase(watch.id)) {
+      continue;
+    }
+
+    const Trap trap = trap_of(state, watch);
+    const uintptr_t address_value = reinterpret_cast<uintptr_t>(watch.address);
+    add_routes(context, watch.id, address_value,
+               address_value + watch.size - 1, trap);
+
+    if (trap == Trap::guard) {
+      guarded.emplace_back(address_value, address_value + watch.size);
+    }
+  }
+
+  // one protection change per run of adjacent or overlapping ranges
+  std::sort(guarded.begin(), guarded.end());
+  size_t i = 0;
+  while (i < guarded.size()) {
+    auto [start, end] = guarded[i];
+    while (++i < guarded.size() && guarded[i].first <= end) {
+      end = std::max(end, guarded[i].second);
+    }
+
+    protect_memory(start, end - start,
+                   [](DWORD protect) { return protect | PAGE_GUARD; });
+  }
+}
+
+void datamon::detail::set_filter(size_t id,
+                                 std::shared_ptr<const PcFilter> filter,
+                                 Context& context) {
+  auto& state = context.state();
+  std::unique_lock lock{state.mutex};
+
+  auto& filters = state.filters[id];
+  filters.code = std::move(filter);
+  if (!filters.code && !filters.threads) {
+    state.filters.erase(id);
+  }
+  update_required_tags(state);
+}
+
+void datamon::detail::set_thread_filter(
+    size_t id, std::shared_ptr<const ThreadFilter> filter, Context& context) {
+  auto& state = context.state();
+  std::unique_lock lock{state.mutex};
+
+  auto& filters = state.filters[id];
+  filters.threads = std::move(filter);
+  if (!filters.code && !filters.threads) {
+    state.filters.erase(id);
+  }
+  update_required_tags(state);
+}
+
+datamon::Datamon::Datamon(void* address, size_t size, InterceptorFn interceptor)
+    : Datamon(Context::global(), address, size, interceptor) {}
+
+datamon::Datamon::Datamon(Context& context, void* address, size_t size,
+                          InterceptorFn interceptor)
+    : context_(context),
+      address_(address),
+      size_(size),
+      interceptor_(interceptor) {
+  interceptor_entry_id_ =
+      detail::add_coalesced_watch(address_, size_, interceptor_, context_);
+}
+
+datamon::Datamon::~Datamon() {
+  detail::remove_watch(interceptor_entry_id_, address_, size_, context_);
+}
+
+void datamon::Datamon::isolate() {
+  if (!coalesced_) {
+    return;
+  }
+
+  // register the own entry before leaving the shared one, so no access goes
+  // unreported in between
+  const size_t id = detail::add_watch(
+      address_, size_,
+      [this](const Event& event) {
+        interceptor_(event.accessing_address, event.read, event.data);
+      },
+      detail::Trap::guard, context_);
+  detail::remove_watch(interceptor_entry_id_, address_, size_, context_);
+
+  interceptor_entry_id_ = id;
+  coalesced_ = false;
+}
+
+void datamon::Datamon::set_filter(PcFilter filter) {
+  isolate();
+  detail::set_filter(interceptor_entry_id_,
+                     std::make_shared<const PcFilter>(std::move(filter)),
+                     context_);
+}
+
+void datamon::Datamon::clear_filter() {
+  detail::set_filter(interceptor_entry_id_, nullptr, context_);
+}
+
+void datamon::Datamon::set_thread_filter(ThreadFilter filter) {
+  isolate();
+  detail::set_thread_filter(
+      interceptor_entry_id_,
+      std::make_shared<const ThreadFilter>(std::move(filter)), context_);
+}
+
+void datamon::Datamon::clear_thread_filter() {
+  detail::set_thread_filter(interceptor_entry_id_, nullptr, context_);
+}
+
+void datamon::detail::arm_writes(void* address, size_t size) {
+  std::unique_lock lock{write_mutex()};
+
+  const uintptr_t first = reinterpret_cast<uintptr_t>(address) &
+                          ~(page_size() - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+
+  // protect runs of newly armed pages with as few calls as possible
+  uintptr_t run_start = 0;
+  uintptr_t region_end = 0;
+  bool region_writable = false;
+  for (uintptr_t page = first; page < end; page += page_size()) {
+    auto [it, inserted] = write_refs().try_emplace(page, WriteRef{0, false});
+    if (++it->second.count == 1) {
+      if (page >= region_end) {
+        MEMORY_BASIC_INFORMATION mbi = virtual_query(page);
+        region_end =
+            reinterpret_cast<uintptr_t>(mbi.BaseAddress) + mbi.RegionSize;
+        region_writable = is_writable(page);
+      }
+      it->second.writable = region_writable;
+
+      if (!run_start) {
+        run_start = page;
+      }
+    } else if (run_start) {
+      protect_memory(run_start, page - run_start, without_write);
+      run_start = 0;
+    }
+  }
+
+  if (run_start) {
+    protect_memory(run_start, end - run_start, without_write);
+  }
+}
+
+void datamon::detail::disarm_writes(void* address, size_t size) {
+  std::unique_lock lock{write_mutex()};
+
+  const uintptr_t first = reinterpret_cast<uintptr_t>(address) &
+                          ~(page_size() - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(address) + size;
+
+  uintptr_t run_start = 0;
+  for (uintptr_t page = first; page < end; page += page_size()) {
+    auto it = write_refs().find(page);
+    bool lift = false;
+    if (it != write_refs().end() && --it->second.count == 0) {
+      lift = it->second.writable;
+      write_refs().erase(it);
+    }
+
+    if (lift) {
+      if (!run_start) {
+        run_start = page;
+      }
+    } else if (run_start) {
+      protect_memory(run_start, page - run_start, with_write);
+      run_start = 0;
+    }
+  }
+
+  if (run_start) {
+    protect_memory(run_start, end - run_start, with_write);
+  }
 }
\ No newline at end of file
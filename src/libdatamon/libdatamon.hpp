@@ -2,6 +2,10 @@
 
 #include <cstdint>
 
+#include "context.hpp"
+#include "pc_filter.hpp"
+#include "thread_filter.hpp"
+
 namespace datamon {
 
 //! @brief The type of the interception function.
@@ -11,6 +15,11 @@ namespace datamon {
 using InterceptorFn = void (*)(void* accessing_address, bool read, void* data);
 
 //! @brief Allows you to intercept access to arbitrary data.
+//!
+//! Datamons of the same interceptor over adjacent or overlapping data share a
+//! single entry in the index of their context, so fragmented watches don't
+//! multiply the work per fault and the interceptor is called once per access.
+//! A filter gives the Datamon an entry of its own.
 class Datamon {
  public:
   //! @brief Creates a new Datamon instance.
@@ -19,6 +28,16 @@ class Datamon {
   //! @param interceptor The interceptor callback function to call when the data
   //! is accessed.
   Datamon(void* address, size_t size, InterceptorFn interceptor);
+
+  //! @brief Creates a new Datamon instance in the given context.
+  //! @param context The context to register the watch in. It has to outlive
+  //! the Datamon.
+  //! @param address The address of the data to be monitored.
+  //! @param size The size of the data to be monitored.
+  //! @param interceptor The interceptor callback function to call when the data
+  //! is accessed.
+  Datamon(Context& context, void* address, size_t size,
+          InterceptorFn interceptor);
   ~Datamon();
 
   Datamon(const Datamon&) = delete;
@@ -26,10 +45,41 @@ class Datamon {
   Datamon& operator=(const Datamon&) = delete;
   Datamon& operator=(Datamon&&) = delete;
 
+  //! @brief The address of the monitored data.
+  void* address() const { return address_; }
+
+  //! @brief The size of the monitored data.
+  size_t size() const { return size_; }
+
+  //! @brief The context the watch is registered in.
+  Context& context() const { return context_; }
+
+  //! @brief Only reports the accesses the filter accepts, e.g. to ignore the
+  //! accesses of your own serialization code. Filtered accesses still fault,
+  //! but the interceptor isn't called.
+  void set_filter(PcFilter filter);
+
+  //! @brief Reports all accesses again.
+  void clear_filter();
+
+  //! @brief Only reports the accesses of the threads the filter accepts,
+  //! e.g. to catch foreign threads touching a worker's data. Like the code
+  //! filter, this is checked after the fault.
+  void set_thread_filter(ThreadFilter filter);
+
+  //! @brief Reports the accesses of all threads again.
+  void clear_thread_filter();
+
  private:
+  // moves the watch into an entry of its own, for filters
+  void isolate();
+
+  Context& context_;
   void* address_;
   size_t size_;
   InterceptorFn interceptor_;
+  // whether the watch shares its entry with adjacent watches
+  bool coalesced_ = true;
 
   // the ID of the interceptor entry in the interval tree
   size_t interceptor_entry_id_;
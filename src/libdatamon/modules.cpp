@@ -0,0 +1,254 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "modules.hpp"
+
+#include <Psapi.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// the parts of the loader notification API we use, which the SDK only
+// declares in the DDK headers
+struct LdrUnicodeString {
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+};
+
+struct LdrDllNotificationData {
+  ULONG Flags;
+  const LdrUnicodeString* FullDllName;
+  const LdrUnicodeString* BaseDllName;
+  PVOID DllBase;
+  ULONG SizeOfImage;
+};
+
+constexpr ULONG ldr_dll_notification_reason_loaded = 1;
+constexpr ULONG ldr_dll_notification_reason_unloaded = 2;
+
+using LdrDllNotificationFunction =
+    VOID(CALLBACK*)(ULONG reason, const LdrDllNotificationData* data,
+                    PVOID context);
+using LdrRegisterDllNotification = NTSTATUS(NTAPI*)(
+    ULONG flags, LdrDllNotificationFunction function, PVOID context,
+    PVOID* cookie);
+
+class ModuleTable {
+ public:
+  ModuleTable() {
+    publish({});
+
+    // subscribe before enumerating so no load falls in between. loads that
+    // are seen twice are deduplicated by base address. the notifications run
+    // under the loader lock and take mutex_, and enumerating takes the loader
+    // lock, so mutex_ is only taken to merge the results
+    auto register_notification = reinterpret_cast<LdrRegisterDllNotification>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"),
+                       "LdrRegisterDllNotification"));
+    if (register_notification) {
+      register_notification(0, &ModuleTable::notification, this, &cookie_);
+    }
+
+    std::vector<datamon::Module> modules;
+
+    std::vector<HMODULE> handles(256);
+    DWORD needed = 0;
+    while (EnumProcessModules(GetCurrentProcess(), handles.data(),
+                              static_cast<DWORD>(handles.size() *
+                                                 sizeof(HMODULE)),
+                              &needed) &&
+           needed > handles.size() * sizeof(HMODULE)) {
+      handles.resize(needed / sizeof(HMODULE));
+    }
+    handles.resize(std::min<size_t>(handles.size(), needed / sizeof(HMODULE)));
+
+    for (HMODULE handle : handles) {
+      MODULEINFO info;
+      if (!GetModuleInformation(GetCurrentProcess(), handle, &info,
+                                sizeof(info))) {
+        continue;
+      }
+
+      wchar_t path[MAX_PATH];
+      const DWORD length = GetModuleFileNameW(handle, path, MAX_PATH);
+
+      modules.push_back({0, reinterpret_cast<uintptr_t>(info.lpBaseOfDll),
+                         info.SizeOfImage, std::wstring{path, length}});
+    }
+
+    std::unique_lock lock{mutex_};
+    for (auto& module : modules) {
+      // unloaded while we were enumerating
+      if (std::find(unloaded_.begin(), unloaded_.end(), module.base) ==
+          unloaded_.end()) {
+        add(std::move(module));
+      }
+    }
+    enumerating_ = false;
+    unloaded_.clear();
+  }
+
+  datamon::CodeLocation locate(uintptr_t address) const {
+    const Reader reader{*this};
+    const Snapshot& snapshot = reader.snapshot();
+
+    // the last module starting at or below the address
+    auto it = std::upper_bound(
+        snapshot.begin(), snapshot.end(), address,
+        [](uintptr_t address, const datamon::Module& module) {
+          return address < module.base;
+        });
+    if (it != snapshot.begin()) {
+      --it;
+      if (address - it->base < it->size) {
+        return {it->id, address - it->base};
+      }
+    }
+
+    return {datamon::unknown_module, address};
+  }
+
+  std::vector<datamon::Module> modules() const {
+    const Reader reader{*this};
+    return reader.snapshot();
+  }
+
+ private:
+  using Snapshot = std::vector<datamon::Module>;
+
+  // pins the current snapshot for as long as it lives. readers count
+  // themselves in the slot of the epoch they started in, and a snapshot is
+  // freed once both slots drained after it was replaced
+  class Reader {
+   public:
+    explicit Reader(const ModuleTable& table)
+        : table_(table), slot_(table.epoch_.load() & 1) {
+      table_.readers_[slot_].fetch_add(1);
+      snapshot_ = table_.current_.load();
+    }
+
+    ~Reader() {
+      table_.readers_[slot_].fetch_sub(1, std::memory_order_release);
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    const Snapshot& snapshot() const { return *snapshot_; }
+
+   private:
+    const ModuleTable& table_;
+    uint32_t slot_;
+    const Snapshot* snapshot_;
+  };
+
+  static VOID CALLBACK notification(ULONG reason,
+                                    const LdrDllNotificationData* data,
+                                    PVOID context) {
+    auto& table = *static_cast<ModuleTable*>(context);
+    std::unique_lock lock{table.mutex_};
+
+    if (reason == ldr_dll_notification_reason_loaded) {
+      table.add({0, reinterpret_cast<uintptr_t>(data->DllBase),
+                 data->SizeOfImage,
+                 std::wstring{data->FullDllName->Buffer,
+                              data->FullDllName->Length / sizeof(wchar_t)}});
+    } else if (reason == ldr_dll_notification_reason_unloaded) {
+      table.remove(reinterpret_cast<uintptr_t>(data->DllBase));
+      if (table.enumerating_) {
+        table.unloaded_.push_back(reinterpret_cast<uintptr_t>(data->DllBase));
+      }
+    }
+  }
+
+  // the following run with mutex_ held
+
+  void add(datamon::Module module) {
+    const Snapshot& current = *current_.load(std::memory_order_relaxed);
+    if (std::any_of(current.begin(), current.end(), [&](const auto& loaded) {
+          return loaded.base == module.base;
+        })) {
+      return;
+    }
+
+    Snapshot next = current;
+    module.id = next_id_++;
+    next.insert(std::upper_bound(next.begin(), next.end(), module.base,
+                                 [](uintptr_t base, const datamon::Module& m) {
+                                   return base < m.base;
+                                 }),
+                std::move(module));
+    publish(std::move(next));
+  }
+
+  void remove(uintptr_t base) {
+    Snapshot next = *current_.load(std::memory_order_relaxed);
+    std::erase_if(next, [base](const auto& module) {
+      return module.base == base;
+    });
+    publish(std::move(next));
+  }
+
+  void publish(Snapshot next) {
+    auto previous = std::exchange(
+        snapshot_, std::make_unique<const Snapshot>(std::move(next)));
+    current_.store(snapshot_.get());
+
+    // wait for the readers that may still hold the previous snapshot. a
+    // reader that read the epoch before a flip may count itself in the old
+    // slot after the wait, so both slots have to drain once. readers only
+    // binary search or copy a snapshot, so this is short
+    for (int flip = 0; flip < 2; ++flip) {
+      const uint32_t slot = epoch_.fetch_xor(1) & 1;
+      while (readers_[slot].load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  // the current snapshot. replaced ones are freed once no reader holds them
+  std::unique_ptr<const Snapshot> snapshot_;
+  std::atomic<const Snapshot*> current_;
+  std::atomic<uint32_t> epoch_ = 0;
+  mutable std::atomic<uint32_t> readers_[2] = {};
+  uint32_t next_id_ = 0;
+  PVOID cookie_ = nullptr;
+  // the modules unloaded while the constructor enumerated the loaded ones
+  bool enumerating_ = true;
+  std::vector<uintptr_t> unloaded_;
+};
+
+ModuleTable& module_table() {
+  // never destroyed, since a handler may still look up addresses during exit
+  static ModuleTable& table = *new ModuleTable;
+  return table;
+}
+
+}  // namespace
+
+void datamon::load_modules() { module_table(); }
+
+datamon::CodeLocation datamon::locate(const void* address) {
+  return module_table().locate(reinterpret_cast<uintptr_t>(address));
+}
+
+std::vector<datamon::Module> datamon::modules() {
+  return module_table().modules();
+}
+
+std::optional<datamon::Module> datamon::module(uint32_t id) {
+  for (auto& module : modules()) {
+    if (module.id == id) {
+      return module;
+    }
+  }
+  return std::nullopt;
+}
\ No newline at end of file
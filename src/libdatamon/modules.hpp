@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace datamon {
+
+//! @brief A module (executable or DLL) loaded into the process.
+struct Module {
+  //! Identifies the module for as long as it stays loaded. Ids are never
+  //! reused within a process, so a module that is unloaded and loaded again
+  //! gets a new one.
+  uint32_t id;
+  uintptr_t base;
+  size_t size;
+  std::filesystem::path path;
+};
+
+//! @brief A code address as a module and an offset into it, which stays the
+//! same across runs regardless of where the module was loaded.
+struct CodeLocation {
+  //! The id of the module, or unknown_module if the address isn't inside a
+  //! module, e.g. in JIT compiled code.
+  uint32_t module;
+  //! The offset into the module, or the address itself for unknown_module.
+  uintptr_t offset;
+};
+
+//! @brief The module id of addresses outside of any module.
+constexpr uint32_t unknown_module = UINT32_MAX;
+
+//! @brief Builds the table of loaded modules, which is otherwise built by the
+//! first call to any of the functions below. Building it takes the loader
+//! lock, so it has to be built before lookups can happen inside an exception
+//! handler, e.g. when an interceptor attributes its events.
+void load_modules();
+
+//! @brief Attributes a code address, e.g. an event's accessing_address, to a
+//! module. The table of loaded modules is kept up to date through loader
+//! notifications. Lookups binary search an immutable snapshot of it without
+//! taking locks, so they are cheap enough to call from the exception handler
+//! once the table is built.
+CodeLocation locate(const void* address);
+
+//! @brief The currently loaded modules, sorted by base address.
+std::vector<Module> modules();
+
+//! @brief A loaded module by id.
+//! @return The module, or nothing if it has been unloaded since.
+std::optional<Module> module(uint32_t id);
+
+}  // namespace datamon
\ No newline at end of file
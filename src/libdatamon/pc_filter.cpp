@@ -0,0 +1,135 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "pc_filter.hpp"
+
+#include <algorithm>
+#include <cwctype>
+
+namespace {
+
+// inserts [start, end) into sorted, disjoint ranges, merging it with every
+// range it overlaps or touches
+void insert_range(std::vector<std::pair<uintptr_t, uintptr_t>>& ranges,
+                  uintptr_t start, uintptr_t end) {
+  auto first = std::lower_bound(
+      ranges.begin(), ranges.end(), start,
+      [](const auto& range, uintptr_t start) { return range.second < start; });
+  auto last = first;
+  while (last != ranges.end() && last->first <= end) {
+    start = std::min(start, last->first);
+    end = std::max(end, last->second);
+    ++last;
+  }
+
+  ranges.insert(ranges.erase(first, last), {start, end});
+}
+
+// whether sorted, disjoint ranges contain an address
+bool contains(const std::vector<std::pair<uintptr_t, uintptr_t>>& ranges,
+              uintptr_t address) {
+  // the first range ending after the address
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), address,
+      [](uintptr_t address, const auto& range) {
+        return address < range.second;
+      });
+  return it != ranges.end() && it->first <= address;
+}
+
+// file names are compared case insensitively, like the loader does
+bool same_file_name(const std::filesystem::path& a,
+                    const std::filesystem::path& b) {
+  const std::wstring left = a.filename().wstring();
+  const std::wstring right = b.filename().wstring();
+  return std::equal(left.begin(), left.end(), right.begin(), right.end(),
+                    [](wchar_t l, wchar_t r) {
+                      return std::towlower(l) == std::towlower(r);
+                    });
+}
+
+}  // namespace
+
+datamon::PcFilter& datamon::PcFilter::add_range(const void* start,
+                                                size_t size) {
+  const uintptr_t range_start = reinterpret_cast<uintptr_t>(start);
+  insert_range(ranges_, range_start, range_start + size);
+  return *this;
+}
+
+datamon::PcFilter& datamon::PcFilter::add_range(CodeLocation start,
+                                                size_t size) {
+  if (start.module == unknown_module) {
+    return add_range(reinterpret_cast<const void*>(start.offset), size);
+  }
+
+  // accepts() locates the accessing code, possibly inside the handler
+  load_modules();
+
+  // the ranges of one module are consecutive, sorted by offset
+  auto first = std::lower_bound(
+      module_ranges_.begin(), module_ranges_.end(), start.module,
+      [](const auto& range, uint32_t module) { return range.first < module; });
+  auto last = std::upper_bound(
+      first, module_ranges_.end(), start.module,
+      [](uint32_t module, const auto& range) { return module < range.first; });
+
+  std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+  for (auto it = first; it != last; ++it) {
+    ranges.push_back(it->second);
+  }
+  insert_range(ranges, start.offset, start.offset + size);
+
+  auto position = module_ranges_.erase(first, last);
+  for (const auto& range : ranges) {
+    position = module_ranges_.insert(position, {start.module, range}) + 1;
+  }
+  return *this;
+}
+
+datamon::PcFilter& datamon::PcFilter::add_module_range(
+    const std::filesystem::path& module, uintptr_t offset, size_t size) {
+  for (const auto& loaded : modules()) {
+    if (same_file_name(loaded.path, module)) {
+      return add_range(CodeLocation{loaded.id, offset}, size);
+    }
+  }
+  return *this;
+}
+
+datamon::PcFilter& datamon::PcFilter::add_module(const void* address) {
+  const CodeLocation location = locate(address);
+  if (location.module == unknown_module) {
+    return *this;
+  }
+
+  const auto module = datamon::module(location.module);
+  if (!module) {
+    return *this;
+  }
+
+  // relative, so a module loaded at the same address later isn't matched
+  return add_range(CodeLocation{location.module, 0}, module->size);
+}
+
+bool datamon::PcFilter::accepts(const void* accessing_address) const {
+  bool inside =
+      contains(ranges_, reinterpret_cast<uintptr_t>(accessing_address));
+
+  if (!inside && !module_ranges_.empty()) {
+    // lock-free, the module table was built when the ranges were added
+    const CodeLocation location = locate(accessing_address);
+    auto it = std::upper_bound(
+        module_ranges_.begin(), module_ranges_.end(), location,
+        [](const CodeLocation& location, const auto& range) {
+          return location.module < range.first ||
+                 (location.module == range.first &&
+                  location.offset < range.second.second);
+        });
+    inside = it != module_ranges_.end() && it->first == location.module &&
+             it->second.first <= location.offset;
+  }
+
+  return inside == (mode_ == Mode::include);
+}
\ No newline at end of file
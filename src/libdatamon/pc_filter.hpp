@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include "modules.hpp"
+
+namespace datamon {
+
+//! @brief Decides by the address of the accessing code whether an access is
+//! reported. Holds small sorted arrays of disjoint code ranges, so a check
+//! is a binary search. Ranges are either absolute or relative to a module;
+//! the latter are checked against the location of the code from locate().
+class PcFilter {
+ public:
+  enum class Mode {
+    //! Only accesses from code inside the ranges are reported.
+    include,
+    //! Accesses from code inside the ranges are ignored.
+    exclude,
+  };
+
+  explicit PcFilter(Mode mode = Mode::exclude) : mode_(mode) {}
+
+  //! @brief Adds a range of code.
+  //! @param start The start of the range.
+  //! @param size The size of the range.
+  PcFilter& add_range(const void* start, size_t size);
+
+  //! @brief Adds a range of code relative to a module. The range stays with
+  //! the module and stops matching once the module is unloaded.
+  //! @param start The module and the offset of the start of the range, e.g.
+  //! from locate(). A location in unknown_module is an absolute address.
+  //! @param size The size of the range.
+  PcFilter& add_range(CodeLocation start, size_t size);
+
+  //! @brief Adds a range of code by the file name of its module, e.g. for a
+  //! module offset recorded in an earlier run. Does nothing if no module of
+  //! that name is loaded.
+  //! @param module The file name of the module, e.g. "game.dll".
+  //! @param offset The offset of the start of the range into the module.
+  //! @param size The size of the range.
+  PcFilter& add_module_range(const std::filesystem::path& module,
+                             uintptr_t offset, size_t size);
+
+  //! @brief Adds the whole module containing an address, e.g. the address of
+  //! a function of it. Does nothing if the address is not inside a module.
+  PcFilter& add_module(const void* address);
+
+  //! @brief Whether an access from the given code is reported.
+  bool accepts(const void* accessing_address) const;
+
+ private:
+  Mode mode_;
+  // sorted, disjoint [start, end) ranges
+  std::vector<std::pair<uintptr_t, uintptr_t>> ranges_;
+  // sorted, disjoint [start, end) offset ranges by module id
+  std::vector<std::pair<uint32_t, std::pair<uintptr_t, uintptr_t>>>
+      module_ranges_;
+};
+
+}  // namespace datamon
\ No newline at end of file
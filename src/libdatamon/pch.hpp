@@ -3,9 +3,11 @@
 #ifndef PCH_H
 #define PCH_H
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <mutex>
+#include <shared_mutex>
 
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
@@ -0,0 +1,98 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "pointer_watch.hpp"
+
+#include "watch.hpp"
+
+struct datamon::PointerWatch::Target {
+  Target(size_t size, InterceptorFn interceptor, Context& context)
+      : size(size), interceptor(interceptor), context(context) {}
+
+  std::mutex mutex;
+  size_t size;
+  InterceptorFn interceptor;
+  Context& context;
+
+  // the watched pointee, nullptr while there is none
+  void* address = nullptr;
+  size_t watch_id = 0;
+  // cleared when the PointerWatch goes away, the pointer must not be read
+  // after that
+  bool following = true;
+
+  // moves the watch to wherever the pointer points now
+  void follow(void** pointer) {
+    std::unique_lock lock{mutex};
+    if (!following) {
+      return;
+    }
+
+    void* new_address = *pointer;
+    if (new_address == address) {
+      return;
+    }
+
+    unwatch();
+
+    if (!new_address) {
+      return;
+    }
+
+    try {
+      watch_id = detail::add_watch(
+          new_address, size,
+          [interceptor = interceptor](const Event& event) {
+            interceptor(event.accessing_address, event.read, event.data);
+          },
+          detail::Trap::guard, context);
+      address = new_address;
+    } catch (const std::runtime_error&) {
+      // the pointee can't be guarded, e.g. because it isn't mapped. stay
+      // detached until the pointer is written again
+    }
+  }
+
+  void stop() {
+    std::unique_lock lock{mutex};
+    following = false;
+    unwatch();
+  }
+
+ private:
+  void unwatch() {
+    if (address) {
+      detail::remove_watch(watch_id, address, size, context);
+      address = nullptr;
+    }
+  }
+};
+
+datamon::PointerWatch::PointerWatch(void** pointer, size_t pointee_size,
+                                    InterceptorFn interceptor,
+                                    Context& context)
+    : pointer_(pointer),
+      context_(context),
+      target_(std::make_shared<Target>(pointee_size, interceptor, context)) {
+  target_->follow(pointer_);
+
+  // only writes to the pointer matter, and those are handled once they have
+  // landed
+  watch_id_ = detail::add_watch(
+      pointer_, sizeof(void*), [](const Event&) {}, detail::Trap::guard,
+      context_,
+      [target = target_, pointer = pointer_](const Event&) {
+        target->follow(pointer);
+      });
+}
+
+datamon::PointerWatch::~PointerWatch() {
+  detail::remove_watch(watch_id_, pointer_, sizeof(void*), context_);
+  target_->stop();
+}
+
+void* datamon::PointerWatch::target() const {
+  std::unique_lock lock{target_->mutex};
+  return target_->address;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "context.hpp"
+#include "libdatamon.hpp"
+
+namespace datamon {
+
+//! @brief Watches whatever object a pointer points at. The pointer itself is
+//! guarded, and after every write to it the handler reads the new value and
+//! moves the watch on the pointee there, right after the writing instruction
+//! has executed. Accesses to the pointer are not reported, only accesses to
+//! the pointee.
+//!
+//! @code
+//! datamon::PointerWatch watch{&g_config->current, interceptor};
+//! @endcode
+class PointerWatch {
+ public:
+  //! @brief Starts watching the target of a pointer.
+  //! @param pointer The pointer to follow.
+  //! @param interceptor The interceptor callback function to call when the
+  //! pointee is accessed.
+  //! @param context The context to register the watches in. It has to
+  //! outlive the PointerWatch.
+  template <typename T>
+  PointerWatch(T** pointer, InterceptorFn interceptor,
+               Context& context = Context::global())
+      : PointerWatch(reinterpret_cast<void**>(pointer), sizeof(T), interceptor,
+                     context) {}
+
+  //! @brief Starts watching the target of an untyped pointer.
+  //! @param pointer The pointer to follow.
+  //! @param pointee_size The size of the data to watch at the target.
+  //! @param interceptor The interceptor callback function to call when the
+  //! pointee is accessed.
+  //! @param context The context to register the watches in. It has to
+  //! outlive the PointerWatch.
+  PointerWatch(void** pointer, size_t pointee_size, InterceptorFn interceptor,
+               Context& context = Context::global());
+  ~PointerWatch();
+
+  PointerWatch(const PointerWatch&) = delete;
+  PointerWatch(PointerWatch&&) = delete;
+  PointerWatch& operator=(const PointerWatch&) = delete;
+  PointerWatch& operator=(PointerWatch&&) = delete;
+
+  //! @brief The currently watched pointee, or nullptr if the pointer is null
+  //! or its target could not be watched.
+  void* target() const;
+
+ private:
+  struct Target;
+
+  void** pointer_;
+  Context& context_;
+  // shared with the post-write callback, which may still be pending on
+  // another thread while we are destroyed
+  std::shared_ptr<Target> target_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,238 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "race_detector.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <random>
+
+#include "watch.hpp"
+
+namespace {
+
+// the vector clock of the calling thread, indexed by thread slot
+struct ThreadClock {
+  uint32_t slot;
+  std::vector<uint64_t> clock;
+
+  ThreadClock() {
+    static std::atomic<uint32_t> next_slot = 0;
+    slot = next_slot++;
+    clock.resize(slot + 1);
+    clock[slot] = 1;
+  }
+
+  uint64_t at(uint32_t other) const {
+    return other < clock.size() ? clock[other] : 0;
+  }
+
+  void join(const std::vector<uint64_t>& other) {
+    if (clock.size() < other.size()) {
+      clock.resize(other.size());
+    }
+    for (size_t i = 0; i < other.size(); ++i) {
+      clock[i] = std::max(clock[i], other[i]);
+    }
+  }
+};
+
+ThreadClock& thread_clock() {
+  thread_local ThreadClock clock;
+  return clock;
+}
+
+// the clocks published to each synchronization object
+std::mutex& sync_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::unordered_map<const void*, std::vector<uint64_t>>& sync_clocks() {
+  static std::unordered_map<const void*, std::vector<uint64_t>> clocks;
+  return clocks;
+}
+
+}  // namespace
+
+datamon::RaceDetector::RaceDetector(void* address, size_t size,
+                                    Options options)
+    : address_(address), size_(size), options_(options) {
+  const size_t page_size = detail::page_size();
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address);
+
+  base_ = address_value & ~(page_size - 1);
+  page_count_ = (address_value + size - base_ + page_size - 1) / page_size;
+
+  rotate();
+
+  sampler_ = std::thread{[this] {
+    std::unique_lock lock{sampler_mutex_};
+    while (!sampler_wake_.wait_for(lock, options_.period,
+                                   [this] { return stopping_; })) {
+      lock.unlock();
+      rotate();
+      lock.lock();
+    }
+  }};
+}
+
+datamon::RaceDetector::~RaceDetector() {
+  {
+    std::unique_lock lock{sampler_mutex_};
+    stopping_ = true;
+  }
+  sampler_wake_.notify_one();
+  sampler_.join();
+
+  const size_t page_size = detail::page_size();
+  for (auto [page, watch_id] : sampled_) {
+    detail::remove_watch(watch_id,
+                         reinterpret_cast<void*>(base_ + page * page_size),
+                         page_size);
+  }
+}
+
+void datamon::RaceDetector::rotate() {
+  const size_t page_size = detail::page_size();
+
+  for (auto [page, watch_id] : sampled_) {
+    detail::remove_watch(watch_id,
+                         reinterpret_cast<void*>(base_ + page * page_size),
+                         page_size);
+  }
+  sampled_.clear();
+
+  thread_local std::mt19937_64 random{std::random_device{}()};
+
+  const size_t count = std::clamp<size_t>(
+      static_cast<size_t>(options_.sample_fraction * page_count_), 1,
+      page_count_);
+  std::vector<size_t> pages(page_count_);
+  std::iota(pages.begin(), pages.end(), size_t{0});
+  std::shuffle(pages.begin(), pages.end(), random);
+  pages.resize(count);
+
+  for (size_t page : pages) {
+    sampled_.emplace_back(
+        page, detail::add_watch(
+                  reinterpret_cast<void*>(base_ + page * page_size), page_size,
+                  [this](const Event& event) {
+                    const uintptr_t data =
+                        reinterpret_cast<uintptr_t>(event.data);
+                    const uintptr_t start =
+                        reinterpret_cast<uintptr_t>(address_);
+                    if (data < start || data - start >= size_) {
+                      // the rest of a page the region only partly covers
+                      return;
+                    }
+
+                    // the handler runs on the accessing thread, so its clock
+                    // is ours
+                    const ThreadClock& clock = thread_clock();
+                    check({clock.slot, clock.clock[clock.slot],
+                           event.thread_id, event.accessing_address},
+                          event.read, data - start);
+                  },
+                  detail::Trap::guard));
+  }
+}
+
+void datamon::RaceDetector::check(const Access& access, bool read,
+                                  size_t offset) {
+  const ThreadClock& clock = thread_clock();
+
+  // whether an earlier access of another thread doesn't happen before this
+  // one
+  const auto unordered = [&](const Access& earlier) {
+    return earlier.slot != access.slot &&
+           earlier.clock > clock.at(earlier.slot);
+  };
+
+  std::unique_lock lock{mutex_};
+  Shadow& shadow = shadow_[offset];
+
+  if (shadow.written && unordered(shadow.write)) {
+    report(shadow.write, false, access, read, offset);
+  }
+
+  if (read) {
+    auto it = std::find_if(
+        shadow.reads.begin(), shadow.reads.end(),
+        [&](const Access& other) { return other.slot == access.slot; });
+    if (it != shadow.reads.end()) {
+      *it = access;
+    } else {
+      shadow.reads.push_back(access);
+    }
+    return;
+  }
+
+  for (const Access& earlier : shadow.reads) {
+    if (unordered(earlier)) {
+      report(earlier, true, access, false, offset);
+    }
+  }
+
+  shadow.written = true;
+  shadow.write = access;
+  shadow.reads.clear();
+}
+
+void datamon::RaceDetector::report(const Access& first, bool first_read,
+                                   const Access& second, bool second_read,
+                                   size_t offset) {
+  if (!reported_
+           .emplace(offset, first.accessing_address,
+                    second.accessing_address)
+           .second) {
+    return;
+  }
+
+  races_.push_back({
+      offset,
+      first_read || second_read ? Kind::read_write : Kind::write_write,
+      first.thread_id,
+      first.accessing_address,
+      first_read,
+      second.thread_id,
+      second.accessing_address,
+      second_read,
+  });
+}
+
+std::vector<datamon::RaceDetector::Race> datamon::RaceDetector::races()
+    const {
+  std::unique_lock lock{mutex_};
+  return races_;
+}
+
+void datamon::RaceDetector::release(const void* sync) {
+  ThreadClock& clock = thread_clock();
+
+  {
+    std::unique_lock lock{sync_mutex()};
+    auto& published = sync_clocks()[sync];
+    if (published.size() < clock.clock.size()) {
+      published.resize(clock.clock.size());
+    }
+    for (size_t i = 0; i < clock.clock.size(); ++i) {
+      published[i] = std::max(published[i], clock.clock[i]);
+    }
+  }
+
+  // accesses after the release are not covered by it
+  ++clock.clock[clock.slot];
+}
+
+void datamon::RaceDetector::acquire(const void* sync) {
+  ThreadClock& clock = thread_clock();
+
+  std::unique_lock lock{sync_mutex()};
+  auto it = sync_clocks().find(sync);
+  if (it != sync_clocks().end()) {
+    clock.join(it->second);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Detects data races on a region by sampling. Each thread carries a
+//! vector clock that only advances through the annotations release() and
+//! acquire(), and for every accessed byte offset the detector remembers the
+//! last write and the last read of each thread. An access races with an
+//! earlier one of another thread if at least one of them is a write and the
+//! earlier one doesn't happen before it according to the clocks.
+//!
+//! Only a random subset of the pages is watched at a time, rotated
+//! periodically, which bounds the overhead by the sampled fraction. Races
+//! are found when both accesses fall into sampled periods.
+class RaceDetector {
+ public:
+  struct Options {
+    //! The fraction of pages watched at a time. At least one page is.
+    double sample_fraction = 0.05;
+    //! How often a new subset of pages is picked.
+    std::chrono::milliseconds period{100};
+  };
+
+  enum class Kind {
+    write_write,
+    read_write,
+  };
+
+  //! @brief Two unordered accesses to the same offset.
+  struct Race {
+    //! The offset of the accessed data from the start of the region.
+    size_t offset;
+    Kind kind;
+    //! The earlier access.
+    uint32_t first_thread_id;
+    void* first_accessing_address;
+    bool first_read;
+    //! The later access.
+    uint32_t second_thread_id;
+    void* second_accessing_address;
+    bool second_read;
+  };
+
+  //! @brief Starts looking for races on a region.
+  //! @param address The start of the region.
+  //! @param size The size of the region.
+  RaceDetector(void* address, size_t size)
+      : RaceDetector(address, size, Options{}) {}
+  RaceDetector(void* address, size_t size, Options options);
+  ~RaceDetector();
+
+  RaceDetector(const RaceDetector&) = delete;
+  RaceDetector(RaceDetector&&) = delete;
+  RaceDetector& operator=(const RaceDetector&) = delete;
+  RaceDetector& operator=(RaceDetector&&) = delete;
+
+  //! @brief The races found so far, each pair of code addresses and offset
+  //! reported once.
+  std::vector<Race> races() const;
+
+  //! @brief Annotates that the calling thread publishes its writes through a
+  //! synchronization object, e.g. right before unlocking a mutex or storing
+  //! a flag with release semantics.
+  static void release(const void* sync);
+
+  //! @brief Annotates that the calling thread observes the writes published
+  //! through a synchronization object, e.g. right after locking a mutex.
+  static void acquire(const void* sync);
+
+ private:
+  // an access, identified by the clock of its thread at the time
+  struct Access {
+    uint32_t slot;
+    uint64_t clock;
+    uint32_t thread_id;
+    void* accessing_address;
+  };
+
+  struct Shadow {
+    bool written = false;
+    Access write;
+    // the last read of each thread since the last write
+    std::vector<Access> reads;
+  };
+
+  void check(const Access& access, bool read, size_t offset);
+  void report(const Access& first, bool first_read, const Access& second,
+              bool second_read, size_t offset);
+  void rotate();
+
+  uintptr_t base_;
+  size_t page_count_;
+  void* address_;
+  size_t size_;
+  Options options_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<size_t, Shadow> shadow_;
+  std::vector<Race> races_;
+  std::set<std::tuple<size_t, void*, void*>> reported_;
+
+  // the currently sampled pages and the IDs of their watch entries in the
+  // interval tree. only touched by the sampling thread and the destructor
+  std::vector<std::pair<size_t, size_t>> sampled_;
+
+  std::mutex sampler_mutex_;
+  std::condition_variable sampler_wake_;
+  bool stopping_ = false;
+  std::thread sampler_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+namespace datamon {
+
+//! @brief A range of memory.
+struct Region {
+  void* address;
+  size_t size;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,537 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "remote_monitor.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "watch.hpp"
+
+#ifdef _WIN64
+#define XIP Rip
+#else
+#define XIP Eip
+#endif
+
+// how long the debug loop waits for an event before it looks for changed
+// watches again, in milliseconds
+constexpr DWORD poll_interval = 50;
+
+// steady clock time in nanoseconds, on the same clock as the in-process
+// events
+uint64_t steady_time() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// the aligned chunks of up to a pointer's size that make up a range, one per
+// debug register
+std::vector<std::pair<uintptr_t, size_t>> breakpoint_chunks(uintptr_t address,
+                                                             size_t size) {
+  std::vector<std::pair<uintptr_t, size_t>> chunks;
+
+  const uintptr_t end = address + size;
+  while (address < end) {
+    size_t length = sizeof(void*);
+    while (address % length != 0 || length > end - address) {
+      length /= 2;
+    }
+
+    chunks.emplace_back(address, length);
+    address += length;
+  }
+
+  return chunks;
+}
+
+// the LEN bits of dr7 for a chunk length
+uintptr_t dr7_length(size_t length) {
+  switch (length) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 8:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+// adds or lifts PAGE_GUARD on a range in another process. failures are
+// ignored, the process may have freed the memory in the meantime
+void protect_remote(HANDLE process, uintptr_t address, size_t size,
+                    bool guard) {
+  uintptr_t start = address;
+  const uintptr_t end = address + size;
+  while (start < end) {
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQueryEx(process, reinterpret_cast<void*>(start), &mbi,
+                        sizeof(mbi))) {
+      return;
+    }
+
+    const uintptr_t region_end =
+        reinterpret_cast<uintptr_t>(mbi.BaseAddress) + mbi.RegionSize;
+    const DWORD protection =
+        guard ? mbi.Protect | PAGE_GUARD : mbi.Protect & ~PAGE_GUARD;
+    if (mbi.State == MEM_COMMIT && protection != mbi.Protect) {
+      DWORD old_protection;
+      VirtualProtectEx(process, reinterpret_cast<void*>(start),
+                       std::min(end, region_end) - start, protection,
+                       &old_protection);
+    }
+
+    start = region_end;
+  }
+}
+
+// the contents of a chunk in another process
+uint64_t read_remote(HANDLE process, uintptr_t address, size_t length) {
+  uint64_t value = 0;
+  ReadProcessMemory(process, reinterpret_cast<void*>(address), &value, length,
+                    nullptr);
+  return value;
+}
+
+datamon::RemoteMonitor::RemoteMonitor(uint32_t process_id, EventFn fn)
+    : process_id_(process_id), fn_(std::move(fn)) {
+  // debug events are delivered to the thread that attached, so the whole
+  // debug loop runs on a thread of its own
+  std::promise<void> attached;
+  std::future<void> result = attached.get_future();
+  thread_ = std::thread{&RemoteMonitor::run, this, std::move(attached)};
+
+  try {
+    result.get();
+  } catch (...) {
+    thread_.join();
+    throw;
+  }
+}
+
+datamon::RemoteMonitor::~RemoteMonitor() {
+  stopping_ = true;
+  thread_.join();
+}
+
+size_t datamon::RemoteMonitor::add_watch(uintptr_t address, size_t size,
+                                         Mode mode) {
+  if (!size) {
+    throw std::runtime_error{"Cannot watch an empty range."};
+  }
+
+  std::unique_lock lock{mutex_};
+
+  if (mode == Mode::guard) {
+    const size_t id = index_.insert({address, address + size - 1, mode});
+    watches_.emplace(id, Watch{address, size, mode});
+    to_guard_.emplace_back(address, address + size);
+    return id;
+  }
+
+  const auto chunks = breakpoint_chunks(address, size);
+
+  std::vector<Slot*> free_slots;
+  for (Slot& slot : slots_) {
+    if (!slot.used) {
+      free_slots.push_back(&slot);
+    }
+  }
+
+  if (chunks.size() > free_slots.size()) {
+    throw std::runtime_error{"Not enough debug registers for the watch."};
+  }
+
+  const size_t id = index_.insert({address, address + size - 1, mode});
+  watches_.emplace(id, Watch{address, size, mode});
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    *free_slots[i] = {true, id, chunks[i].first, chunks[i].second, mode, 0};
+  }
+  slots_dirty_ = true;
+
+  return id;
+}
+
+void datamon::RemoteMonitor::remove_watch(size_t id) {
+  std::unique_lock lock{mutex_};
+
+  auto watch = watches_.find(id);
+  if (watch == watches_.end()) {
+    return;
+  }
+
+  index_.erase(id);
+
+  if (watch->second.mode == Mode::guard) {
+    to_unguard_.emplace_back(watch->second.address,
+                             watch->second.address + watch->second.size);
+  } else {
+    for (Slot& slot : slots_) {
+      if (slot.used && slot.watch_id == id) {
+        slot.used = false;
+      }
+    }
+    slots_dirty_ = true;
+  }
+
+  watches_.erase(watch);
+}
+
+void datamon::RemoteMonitor::run(std::promise<void> attached) {
+  if (!DebugActiveProcess(process_id_)) {
+    attached.set_exception(std::make_exception_ptr(
+        std::runtime_error{"Failed to attach to the process."}));
+    return;
+  }
+
+  // leave the process running if we go away without detaching
+  DebugSetProcessKillOnExit(FALSE);
+
+  attached_ = true;
+  attached.set_value();
+
+  bool removed = false;
+  while (true) {
+    if (stopping_ && !removed) {
+      remove_all();
+      removed = true;
+    }
+
+    // once the watches are gone, only the events that are still pending are
+    // continued before detaching
+    DEBUG_EVENT debug_event;
+    if (!WaitForDebugEvent(&debug_event, removed ? 0 : poll_interval)) {
+      if (removed) {
+        break;
+      }
+
+      apply();
+      continue;
+    }
+
+    const uint32_t thread_id = debug_event.dwThreadId;
+    DWORD status = DBG_CONTINUE;
+    switch (debug_event.dwDebugEventCode) {
+      case CREATE_PROCESS_DEBUG_EVENT: {
+        const auto& info = debug_event.u.CreateProcessInfo;
+        if (info.hFile) {
+          CloseHandle(info.hFile);
+        }
+        process_ = info.hProcess;
+        threads_[thread_id] = info.hThread;
+
+        std::unique_lock lock{mutex_};
+        set_debug_registers(info.hThread);
+        break;
+      }
+      case CREATE_THREAD_DEBUG_EVENT: {
+        // the threads that already exist are reported this way on attach too
+        threads_[thread_id] = debug_event.u.CreateThread.hThread;
+
+        std::unique_lock lock{mutex_};
+        set_debug_registers(debug_event.u.CreateThread.hThread);
+        break;
+      }
+      case EXIT_THREAD_DEBUG_EVENT:
+        threads_.erase(thread_id);
+        stepping_.erase(thread_id);
+        break;
+      case LOAD_DLL_DEBUG_EVENT:
+        if (debug_event.u.LoadDll.hFile) {
+          CloseHandle(debug_event.u.LoadDll.hFile);
+        }
+        break;
+      case EXCEPTION_DEBUG_EVENT: {
+        const auto& record = debug_event.u.Exception.ExceptionRecord;
+        const bool access = record.NumberParameters >= 2;
+        status = on_exception(
+            thread_id, record.ExceptionCode,
+            access && record.ExceptionInformation[0] == 0,
+            access ? static_cast<uintptr_t>(record.ExceptionInformation[1])
+                   : 0);
+        break;
+      }
+      case EXIT_PROCESS_DEBUG_EVENT:
+        attached_ = false;
+        break;
+    }
+
+    if (!removed) {
+      apply();
+    }
+
+    ContinueDebugEvent(debug_event.dwProcessId, debug_event.dwThreadId,
+                       status);
+
+    if (!attached_) {
+      // the debugging session ends with the process
+      return;
+    }
+  }
+
+  DebugActiveProcessStop(process_id_);
+  attached_ = false;
+}
+
+void datamon::RemoteMonitor::apply() {
+  std::unique_lock lock{mutex_};
+
+  if (!process_) {
+    // not attached yet, everything is applied once the process is reported
+    return;
+  }
+
+  for (auto [start, end] : std::exchange(to_guard_, {})) {
+    protect_remote(process_, start, end - start, true);
+  }
+
+  // pages other guard watches still cover keep their guard. runs of adjacent
+  // pages are unguarded together
+  const size_t page_size = detail::page_size();
+  for (auto [start, end] : std::exchange(to_unguard_, {})) {
+    uintptr_t run_start = 0;
+    uintptr_t run_end = 0;
+    for (uintptr_t page = start & ~(page_size - 1); page < end;
+         page += page_size) {
+      const auto watches = index_.query(page, page + page_size - 1);
+      const bool guarded =
+          std::any_of(watches.begin(), watches.end(), [](const auto& watch) {
+            return watch.value == Mode::guard;
+          });
+
+      if (guarded) {
+        continue;
+      }
+
+      if (run_end != page) {
+        if (run_start != run_end) {
+          protect_remote(process_, run_start, run_end - run_start, false);
+        }
+        run_start = page;
+      }
+      run_end = page + page_size;
+    }
+
+    if (run_start != run_end) {
+      protect_remote(process_, run_start, run_end - run_start, false);
+    }
+  }
+
+  if (slots_dirty_) {
+    for (Slot& slot : slots_) {
+      if (slot.used) {
+        slot.shadow = read_remote(process_, slot.address, slot.length);
+      }
+    }
+
+    for (auto& [thread_id, thread] : threads_) {
+      set_debug_registers(thread);
+    }
+
+    slots_dirty_ = false;
+  }
+}
+
+void datamon::RemoteMonitor::set_debug_registers(void* thread) {
+  // the context of a running thread can't be changed reliably. while a debug
+  // event is pending the threads are stopped anyway
+  SuspendThread(thread);
+
+  CONTEXT context{};
+  context.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+  if (GetThreadContext(thread, &context)) {
+    uintptr_t addresses[4] = {};
+    uintptr_t dr7 = 0;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      const Slot& slot = slots_[i];
+      if (!slot.used) {
+        continue;
+      }
+
+      addresses[i] = slot.address;
+      // local enable, break on writes or on accesses, and the length
+      dr7 |= uintptr_t{1} << (i * 2);
+      dr7 |= uintptr_t{slot.mode == Mode::writes ? 1u : 3u} << (16 + i * 4);
+      dr7 |= dr7_length(slot.length) << (18 + i * 4);
+    }
+
+    context.Dr0 = addresses[0];
+    context.Dr1 = addresses[1];
+    context.Dr2 = addresses[2];
+    context.Dr3 = addresses[3];
+    context.Dr7 = dr7;
+    SetThreadContext(thread, &context);
+  }
+
+  ResumeThread(thread);
+}
+
+uint32_t datamon::RemoteMonitor::on_exception(uint32_t thread_id,
+                                              uint32_t code, bool read,
+                                              uintptr_t data_address) {
+  auto thread = threads_.find(thread_id);
+  if (thread == threads_.end()) {
+    return DBG_EXCEPTION_NOT_HANDLED;
+  }
+
+  const size_t page_size = detail::page_size();
+
+  if (code == EXCEPTION_BREAKPOINT) {
+    // the breakpoint the system raises once we are attached. any other one
+    // belongs to the process
+    return std::exchange(initial_breakpoint_, false)
+               ? DBG_CONTINUE
+               : DBG_EXCEPTION_NOT_HANDLED;
+  }
+
+  if (code == STATUS_GUARD_PAGE_VIOLATION) {
+    const uintptr_t page = data_address & ~(page_size - 1);
+
+    bool ours = false;
+    bool hit = false;
+    {
+      std::unique_lock lock{mutex_};
+      for (const auto& watch : index_.query(page, page + page_size - 1)) {
+        if (watch.value == Mode::guard) {
+          ours = true;
+          hit |= watch.start <= data_address && data_address <= watch.end;
+        }
+      }
+    }
+
+    if (!ours) {
+      // a guard page of the process itself
+      return DBG_EXCEPTION_NOT_HANDLED;
+    }
+
+    // step over the access and guard the page again afterwards, like the
+    // in-process handler
+    CONTEXT context{};
+    context.ContextFlags = CONTEXT_CONTROL;
+    GetThreadContext(thread->second, &context);
+    context.EFlags |= 0x100;
+    SetThreadContext(thread->second, &context);
+    stepping_[thread_id] = data_address;
+
+    if (hit) {
+      fn_({steady_time(), reinterpret_cast<void*>(context.XIP),
+           reinterpret_cast<void*>(data_address), thread_id, read});
+    }
+
+    return DBG_CONTINUE;
+  }
+
+  if (code != EXCEPTION_SINGLE_STEP) {
+    return DBG_EXCEPTION_NOT_HANDLED;
+  }
+
+  CONTEXT context{};
+  context.ContextFlags = CONTEXT_CONTROL | CONTEXT_DEBUG_REGISTERS;
+  GetThreadContext(thread->second, &context);
+
+  bool handled = false;
+  std::vector<Event> events;
+  {
+    std::unique_lock lock{mutex_};
+
+    if (auto step = stepping_.find(thread_id); step != stepping_.end()) {
+      const uintptr_t page = step->second & ~(page_size - 1);
+      stepping_.erase(step);
+      handled = true;
+
+      // unless the watch was removed in the meantime
+      const auto watches = index_.query(page, page + page_size - 1);
+      if (std::any_of(watches.begin(), watches.end(), [](const auto& watch) {
+            return watch.value == Mode::guard;
+          })) {
+        protect_remote(process_, page, page_size, true);
+      }
+    }
+
+    // the debug registers are all ours, so any breakpoint that fired is one
+    // of our watches, even if it was just removed
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      if (!(context.Dr6 & (uintptr_t{1} << i))) {
+        continue;
+      }
+      handled = true;
+
+      Slot& slot = slots_[i];
+      if (!slot.used) {
+        continue;
+      }
+
+      bool slot_read = false;
+      if (slot.mode == Mode::accesses) {
+        const uint64_t value = read_remote(process_, slot.address, slot.length);
+        slot_read = value == slot.shadow;
+        slot.shadow = value;
+      }
+
+      events.push_back({steady_time(), reinterpret_cast<void*>(context.XIP),
+                        reinterpret_cast<void*>(slot.address), thread_id,
+                        slot_read});
+    }
+  }
+
+  if (context.Dr6 & 0xf) {
+    // the status bits are sticky
+    context.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+    context.Dr6 = 0;
+    SetThreadContext(thread->second, &context);
+  }
+
+  for (const Event& event : events) {
+    fn_(event);
+  }
+
+  return handled ? DBG_CONTINUE : DBG_EXCEPTION_NOT_HANDLED;
+}
+
+void datamon::RemoteMonitor::remove_all() {
+  std::unique_lock lock{mutex_};
+
+  for (auto& [id, watch] : watches_) {
+    index_.erase(id);
+    if (watch.mode == Mode::guard && process_) {
+      protect_remote(process_, watch.address, watch.size, false);
+    }
+  }
+  watches_.clear();
+  to_guard_.clear();
+  to_unguard_.clear();
+
+  for (Slot& slot : slots_) {
+    slot.used = false;
+  }
+  slots_dirty_ = false;
+
+  for (auto& [thread_id, thread] : threads_) {
+    set_debug_registers(thread);
+  }
+
+  // a thread stepping past a guard page hit would raise its single step
+  // without a debugger to handle it. steps that were raised already are
+  // still continued by on_exception
+  for (auto& [thread_id, data_address] : stepping_) {
+    auto thread = threads_.find(thread_id);
+    if (thread == threads_.end()) {
+      continue;
+    }
+
+    SuspendThread(thread->second);
+    CONTEXT context{};
+    context.ContextFlags = CONTEXT_CONTROL;
+    if (GetThreadContext(thread->second, &context)) {
+      context.EFlags &= ~0x100;
+      SetThreadContext(thread->second, &context);
+    }
+    ResumeThread(thread->second);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+#include "interval_tree.hpp"
+
+namespace datamon {
+
+//! @brief Monitors data in another process from the outside, by attaching to
+//! it as a debugger. Nothing is loaded into the monitored process: its
+//! accesses are caught with hardware data breakpoints or guard pages, and
+//! the debug events are turned into the same events the in-process handler
+//! reports, so a crash or a slow callback in the monitor can't take the
+//! process down with it.
+//!
+//! The monitor must have the same bitness as the process. Detaching leaves
+//! the process running.
+class RemoteMonitor {
+ public:
+  //! @brief How the accesses of a watch are caught.
+  enum class Mode {
+    //! Hardware data breakpoints on writes. They fire after the write, with
+    //! no cost for accesses to other data, but there are only four debug
+    //! registers, each covering an aligned 1, 2, 4 or 8 byte chunk.
+    writes,
+    //! Hardware data breakpoints on reads and writes. The hardware doesn't
+    //! say which one it was, an access counts as a write if the chunk
+    //! changed.
+    accesses,
+    //! Guard pages in the process, for watches of any size.
+    guard,
+  };
+
+  //! @brief Called on the monitor's thread for every caught access, while the
+  //! accessing thread waits. The data address of a hardware breakpoint hit is
+  //! the start of the chunk, and the accessing address is the instruction
+  //! after the access.
+  using EventFn = std::function<void(const Event& event)>;
+
+  //! @brief Attaches to a process.
+  //! @param process_id The process to monitor.
+  //! @param fn The function to call with the events.
+  RemoteMonitor(uint32_t process_id, EventFn fn);
+  //! @brief Removes all watches from the process and detaches from it.
+  ~RemoteMonitor();
+
+  RemoteMonitor(const RemoteMonitor&) = delete;
+  RemoteMonitor(RemoteMonitor&&) = delete;
+  RemoteMonitor& operator=(const RemoteMonitor&) = delete;
+  RemoteMonitor& operator=(RemoteMonitor&&) = delete;
+
+  //! @brief Starts monitoring data in the process. Takes effect within a
+  //! polling interval.
+  //! @param address The address of the data in the process.
+  //! @param size The size of the data.
+  //! @param mode How to catch the accesses.
+  //! @return The ID of the watch.
+  size_t add_watch(uintptr_t address, size_t size, Mode mode);
+
+  //! @brief Stops monitoring the data of a watch.
+  void remove_watch(size_t id);
+
+  //! @brief Whether the process is still running.
+  bool attached() const { return attached_.load(); }
+
+  uint32_t process_id() const { return process_id_; }
+
+ private:
+  struct Watch {
+    uintptr_t address;
+    size_t size;
+    Mode mode;
+  };
+
+  // a debug register
+  struct Slot {
+    bool used = false;
+    // the ID of the watch entry in the interval tree
+    size_t watch_id;
+    uintptr_t address;
+    size_t length;
+    Mode mode;
+    // the last seen contents of the chunk, to tell reads from writes
+    uint64_t shadow;
+  };
+
+  // the debug loop and the helpers it calls, all on thread_
+  void run(std::promise<void> attached);
+  // brings the debug registers and the guard pages of the process up to date
+  void apply();
+  // writes the debug registers of a thread
+  void set_debug_registers(void* thread);
+  // handles an exception in the process, returns how to continue it
+  uint32_t on_exception(uint32_t thread_id, uint32_t code, bool read,
+                        uintptr_t data_address);
+  // lifts every watch from the process before detaching
+  void remove_all();
+
+  uint32_t process_id_;
+  EventFn fn_;
+
+  std::atomic<bool> attached_ = false;
+  std::atomic<bool> stopping_ = false;
+
+  // guards the watches, shared with the debug loop
+  std::mutex mutex_;
+  // the index the debug events are dispatched through
+  IntervalTree<Mode> index_;
+  std::unordered_map<size_t, Watch> watches_;
+  std::array<Slot, 4> slots_;
+  // the debug registers changed since they were last written
+  bool slots_dirty_ = false;
+  // [start, end) ranges to guard or unguard in the process
+  std::vector<std::pair<uintptr_t, uintptr_t>> to_guard_;
+  std::vector<std::pair<uintptr_t, uintptr_t>> to_unguard_;
+
+  // only touched by the debug loop
+  void* process_ = nullptr;
+  std::unordered_map<uint32_t, void*> threads_;
+  // the data addresses of the threads single stepping past a guard page hit,
+  // to guard again after the step
+  std::unordered_map<uint32_t, uintptr_t> stepping_;
+  bool initial_breakpoint_ = true;
+
+  std::thread thread_;
+};
+
+}  // namespace datamon
\ No newline at end of file
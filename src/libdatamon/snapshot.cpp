@@ -0,0 +1,169 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "watch.hpp"
+
+datamon::Snapshot::Snapshot(std::vector<Region> regions) {
+  const size_t page_size = detail::page_size();
+
+  for (const auto& region : regions) {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(region.address);
+    const uintptr_t base = address & ~(page_size - 1);
+    const size_t page_count =
+        (address + region.size - base + page_size - 1) / page_size;
+    regions_.push_back({base, page_count, page_count_, 0});
+    page_count_ += page_count;
+  }
+
+  states_ = std::make_unique<std::atomic<PageState>[]>(page_count_);
+  buffer_ = static_cast<char*>(VirtualAlloc(nullptr, page_count_ * page_size,
+                                            MEM_RESERVE, PAGE_NOACCESS));
+  if (!buffer_) {
+    throw std::runtime_error{"Failed to reserve snapshot buffer."};
+  }
+
+  for (auto& region : regions_) {
+    region.watch_id = detail::add_watch(
+        reinterpret_cast<void*>(region.base), region.page_count * page_size,
+        [this, &region, page_size](const Event& event) {
+          copy_page(region,
+                    reinterpret_cast<uintptr_t>(event.data) & ~(page_size - 1));
+        },
+        detail::Trap::write_once);
+  }
+
+  // the snapshot is taken the moment the pages become read-only
+  for (const auto& region : regions_) {
+    detail::arm_writes(reinterpret_cast<void*>(region.base),
+                       region.page_count * page_size);
+  }
+}
+
+datamon::Snapshot::~Snapshot() {
+  const size_t page_size = detail::page_size();
+
+  {
+    // release the pages that were never written. copy_page takes the same
+    // lock, so no page can be copied and lifted in between
+    std::unique_lock lock{mutex_};
+    for (const auto& region : regions_) {
+      size_t page = 0;
+      while (page < region.page_count) {
+        if (states_[region.first_page + page] != PageState::original) {
+          ++page;
+          continue;
+        }
+
+        // disarm the whole run of unwritten pages at once
+        size_t run_end = page;
+        while (run_end < region.page_count &&
+               states_[region.first_page + run_end] == PageState::original) {
+          ++run_end;
+        }
+
+        detail::disarm_writes(
+            reinterpret_cast<void*>(region.base + page * page_size),
+            (run_end - page) * page_size);
+        page = run_end;
+      }
+    }
+  }
+
+  for (const auto& region : regions_) {
+    detail::remove_watch(region.watch_id, reinterpret_cast<void*>(region.base),
+                         region.page_count * page_size);
+  }
+
+  VirtualFree(buffer_, 0, MEM_RELEASE);
+}
+
+size_t datamon::Snapshot::copied_count() const {
+  std::unique_lock lock{mutex_};
+  return copied_count_;
+}
+
+size_t datamon::Snapshot::lost_count() const {
+  std::unique_lock lock{mutex_};
+  return lost_count_;
+}
+
+void datamon::Snapshot::read(const void* address, void* buffer,
+                             size_t size) const {
+  const size_t page_size = detail::page_size();
+
+  uintptr_t current = reinterpret_cast<uintptr_t>(address);
+  const RegionPages& region = region_of(current);
+  if (current + size > region.base + region.page_count * page_size) {
+    throw std::runtime_error{"Read crosses the end of the region."};
+  }
+
+  char* out = static_cast<char*>(buffer);
+  while (size) {
+    const uintptr_t page = current & ~(page_size - 1);
+    const size_t chunk = std::min(size, page + page_size - current);
+    const size_t index = region.first_page + (page - region.base) / page_size;
+
+    // read the live page first. if it still wasn't written afterwards, it
+    // was still write protected during the whole read, so the data is
+    // original. otherwise the copy holds the original
+    std::memcpy(out, reinterpret_cast<const void*>(current), chunk);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    switch (states_[index].load(std::memory_order_relaxed)) {
+      case PageState::original:
+        break;
+      case PageState::copied:
+        std::memcpy(out, buffer_ + index * page_size + (current - page),
+                    chunk);
+        break;
+      case PageState::lost:
+        throw std::runtime_error{"The snapshot of the page was lost."};
+    }
+
+    current += chunk;
+    out += chunk;
+    size -= chunk;
+  }
+}
+
+const datamon::Snapshot::RegionPages& datamon::Snapshot::region_of(
+    uintptr_t address) const {
+  for (const auto& region : regions_) {
+    if (region.base <= address &&
+        address < region.base + region.page_count * detail::page_size()) {
+      return region;
+    }
+  }
+  throw std::runtime_error{"Address is not part of the snapshot."};
+}
+
+void datamon::Snapshot::copy_page(const RegionPages& region, uintptr_t page) {
+  const size_t page_size = detail::page_size();
+  const size_t index = region.first_page + (page - region.base) / page_size;
+
+  std::unique_lock lock{mutex_};
+
+  if (states_[index] != PageState::original) {
+    return;
+  }
+
+  char* copy = buffer_ + index * page_size;
+  if (!VirtualAlloc(copy, page_size, MEM_COMMIT, PAGE_READWRITE)) {
+    // nowhere to put the original. the handler lifts the write protection
+    // regardless, so readers have to learn that the page is gone
+    states_[index].store(PageState::lost, std::memory_order_release);
+    ++lost_count_;
+    return;
+  }
+
+  std::memcpy(copy, reinterpret_cast<const void*>(page), page_size);
+
+  // the handler only lets the write through after this returns
+  states_[index].store(PageState::copied, std::memory_order_release);
+  ++copied_count_;
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "region.hpp"
+
+namespace datamon {
+
+//! @brief A copy-on-write snapshot of a set of regions. Taking the snapshot
+//! only write protects the regions; the first write to each page afterwards
+//! copies the page into the snapshot before the write goes through. Readers
+//! get the contents as of the time the snapshot was taken while writers pay
+//! one exception per page.
+class Snapshot {
+ public:
+  using Region = datamon::Region;
+
+  //! @brief Takes a snapshot of a set of regions. The regions are widened to
+  //! whole pages and must not overlap.
+  explicit Snapshot(std::vector<Region> regions);
+  ~Snapshot();
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot(Snapshot&&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+  Snapshot& operator=(Snapshot&&) = delete;
+
+  //! @brief Reads memory as it was when the snapshot was taken. Can be called
+  //! from any thread while writers keep modifying the regions.
+  //! Throws if the range covers a page whose original was lost.
+  //! @param address The address to read from. The whole range has to lie
+  //! within one of the regions.
+  //! @param buffer The buffer to copy the data into.
+  //! @param size The number of bytes to read.
+  void read(const void* address, void* buffer, size_t size) const;
+
+  //! @brief The number of pages that were written, and therefore copied,
+  //! since the snapshot was taken.
+  size_t copied_count() const;
+
+  //! @brief The number of pages that were written but could not be copied,
+  //! e.g. because memory for the copy ran out. Their original contents are
+  //! gone and reading them throws.
+  size_t lost_count() const;
+
+ private:
+  struct RegionPages {
+    uintptr_t base;
+    size_t page_count;
+    // index of the first page of the region in states_ and buffer_
+    size_t first_page;
+    size_t watch_id;
+  };
+
+  enum class PageState : uint8_t {
+    // never written, the live page is the original
+    original,
+    // the original is in the buffer
+    copied,
+    // written, but the original couldn't be copied
+    lost,
+  };
+
+  const RegionPages& region_of(uintptr_t address) const;
+  void copy_page(const RegionPages& region, uintptr_t page);
+
+  std::vector<RegionPages> regions_;
+  size_t page_count_ = 0;
+
+  // set before the handler lets the first write to the page through
+  std::unique_ptr<std::atomic<PageState>[]> states_;
+  // reserved for all pages, committed page by page as they are copied
+  char* buffer_ = nullptr;
+
+  mutable std::mutex mutex_;
+  size_t copied_count_ = 0;
+  size_t lost_count_ = 0;
+};
+
+}  // namespace datamon
\ No newline at end of file
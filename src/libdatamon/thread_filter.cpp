@@ -0,0 +1,46 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "thread_filter.hpp"
+
+#include <algorithm>
+
+namespace {
+
+thread_local uint64_t tags = 0;
+
+}  // namespace
+
+void datamon::set_thread_tags(uint64_t thread_tags) { tags = thread_tags; }
+
+uint64_t datamon::thread_tags() { return tags; }
+
+datamon::ThreadFilter& datamon::ThreadFilter::add_thread(uint32_t thread_id) {
+  auto it =
+      std::lower_bound(thread_ids_.begin(), thread_ids_.end(), thread_id);
+  if (it == thread_ids_.end() || *it != thread_id) {
+    thread_ids_.insert(it, thread_id);
+  }
+  return *this;
+}
+
+datamon::ThreadFilter& datamon::ThreadFilter::add_tags(uint64_t tags) {
+  tags_ |= tags;
+  return *this;
+}
+
+bool datamon::ThreadFilter::accepts(uint32_t thread_id, uint64_t tags) const {
+  const bool selected =
+      (tags & tags_) != 0 ||
+      std::binary_search(thread_ids_.begin(), thread_ids_.end(), thread_id);
+
+  return selected == (mode_ == Mode::include);
+}
+
+uint64_t datamon::ThreadFilter::required_tags() const {
+  if (mode_ == Mode::include && thread_ids_.empty()) {
+    return tags_;
+  }
+  return ~uint64_t{0};
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Replaces the tags of the calling thread. Tags are arbitrary bits
+//! that thread filters can select threads by, e.g. one bit per worker pool.
+void set_thread_tags(uint64_t tags);
+
+//! @brief The tags of the calling thread. Threads start without tags.
+uint64_t thread_tags();
+
+//! @brief Decides by the accessing thread whether an access is reported.
+//! Threads are selected by id or by tag.
+class ThreadFilter {
+ public:
+  enum class Mode {
+    //! Only accesses from the selected threads are reported.
+    include,
+    //! Accesses from the selected threads are ignored.
+    exclude,
+  };
+
+  explicit ThreadFilter(Mode mode = Mode::include) : mode_(mode) {}
+
+  //! @brief Selects a thread by id.
+  ThreadFilter& add_thread(uint32_t thread_id);
+
+  //! @brief Selects the threads that have any of the given tags.
+  ThreadFilter& add_tags(uint64_t tags);
+
+  //! @brief Whether an access from a thread is reported.
+  //! @param thread_id The id of the accessing thread.
+  //! @param tags The tags of the accessing thread.
+  bool accepts(uint32_t thread_id, uint64_t tags) const;
+
+  //! @brief The tags a thread needs at least one of to be accepted, or all
+  //! tags if the filter accepts some threads regardless of their tags.
+  uint64_t required_tags() const;
+
+ private:
+  Mode mode_;
+  // sorted
+  std::vector<uint32_t> thread_ids_;
+  uint64_t tags_ = 0;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,634 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "trace_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <set>
+
+#include "watch.hpp"
+
+namespace {
+
+// "DMTRACE2"
+constexpr uint64_t trace_magic = 0x3245434152544d44;
+
+// the start of the file
+struct FileHeader {
+  uint64_t magic;
+  // the traced region. data addresses are stored as offsets into it
+  uint64_t address;
+  uint64_t size;
+};
+
+void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in == end) {
+      return false;
+    }
+
+    const uint8_t byte = *in++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// maps small negative deltas to small varints
+uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// LZ compression along the lines of LZ4's block format. the data is a
+// sequence of a token (the literal count and the match length minus
+// min_match, 4 bits each, extended by runs of 255 bytes), the literals, and
+// a 16 bit offset back to the match. the last sequence only has literals
+constexpr size_t min_match = 4;
+constexpr int hash_bits = 12;
+
+void put_length(std::vector<uint8_t>& out, size_t length) {
+  while (length >= 255) {
+    out.push_back(255);
+    length -= 255;
+  }
+  out.push_back(static_cast<uint8_t>(length));
+}
+
+bool get_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+  uint8_t byte;
+  do {
+    if (in == end) {
+      return false;
+    }
+    byte = *in++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+std::vector<uint8_t> compress(const std::vector<uint8_t>& in) {
+  std::vector<uint8_t> out;
+  out.reserve(in.size());
+
+  const auto read32 = [&in](size_t at) {
+    uint32_t value;
+    std::memcpy(&value, &in[at], sizeof(value));
+    return value;
+  };
+
+  size_t anchor = 0;
+  const auto emit = [&](size_t literal_end, size_t offset,
+                        size_t match_length) {
+    const size_t literals = literal_end - anchor;
+    const size_t extra = match_length ? match_length - min_match : 0;
+    out.push_back(static_cast<uint8_t>((std::min<size_t>(literals, 15) << 4) |
+                                       std::min<size_t>(extra, 15)));
+    if (literals >= 15) {
+      put_length(out, literals - 15);
+    }
+    out.insert(out.end(), in.begin() + anchor, in.begin() + literal_end);
+
+    if (match_length) {
+      out.push_back(static_cast<uint8_t>(offset));
+      out.push_back(static_cast<uint8_t>(offset >> 8));
+      if (extra >= 15) {
+        put_length(out, extra - 15);
+      }
+    }
+  };
+
+  // the last position each hash of 4 bytes was seen at, plus one
+  std::vector<uint32_t> table(size_t{1} << hash_bits, 0);
+
+  size_t i = 0;
+  while (i + min_match <= in.size()) {
+    const uint32_t value = read32(i);
+    const uint32_t hash = (value * 2654435761u) >> (32 - hash_bits);
+    const size_t candidate = table[hash];
+    table[hash] = static_cast<uint32_t>(i + 1);
+
+    if (!candidate || i - (candidate - 1) > 0xffff ||
+        read32(candidate - 1) != value) {
+      ++i;
+      continue;
+    }
+
+    const size_t match = candidate - 1;
+    size_t length = min_match;
+    while (i + length < in.size() && in[match + length] == in[i + length]) {
+      ++length;
+    }
+
+    emit(i, i - match, length);
+    i += length;
+    anchor = i;
+  }
+
+  emit(in.size(), 0, 0);
+  return out;
+}
+
+bool decompress(const uint8_t* in, size_t size, std::vector<uint8_t>& out) {
+  const uint8_t* end = in + size;
+  while (in < end) {
+    const uint8_t token = *in++;
+
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(in, end, literals)) {
+      return false;
+    }
+    if (static_cast<size_t>(end - in) < literals) {
+      return false;
+    }
+    out.insert(out.end(), in, in + literals);
+    in += literals;
+
+    if (in == end) {
+      break;
+    }
+
+    if (end - in < 2) {
+      return false;
+    }
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+
+    size_t length = token & 15;
+    if (length == 15 && !get_length(in, end, length)) {
+      return false;
+    }
+    length += min_match;
+
+    if (offset == 0 || offset > out.size()) {
+      return false;
+    }
+
+    // the match may overlap the bytes it produces
+    const size_t from = out.size() - offset;
+    for (size_t i = 0; i < length; ++i) {
+      out.push_back(out[from + i]);
+    }
+  }
+  return true;
+}
+
+// the payload of a module record, followed by the path in UTF-8
+struct ModuleRecord {
+  uint64_t base;
+  uint64_t size;
+};
+
+// reads the blocks of a trace file, taking in the module records on the way
+class TraceFile {
+ public:
+  using BlockHeader = datamon::TraceWriter::BlockHeader;
+  using Module = datamon::TraceWriter::Module;
+
+  explicit TraceFile(const std::filesystem::path& path)
+      : file_(path, std::ios::binary) {
+    if (!file_.read(reinterpret_cast<char*>(&header_), sizeof(header_)) ||
+        header_.magic != trace_magic) {
+      throw std::runtime_error{"Not a trace file."};
+    }
+  }
+
+  // reads the next block of events, of any thread or of only the given one.
+  // returns false at the end of the file, or at a truncated block, e.g. when
+  // the process died while writing
+  bool next(BlockHeader& block, std::vector<uint8_t>& raw,
+            std::optional<uint32_t> thread_id = std::nullopt) {
+    while (file_.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+      if (thread_id && block.thread_id != *thread_id &&
+          block.thread_id != datamon::TraceWriter::module_record) {
+        file_.seekg(block.stored_size, std::ios::cur);
+        continue;
+      }
+
+      stored_.resize(block.stored_size);
+      if (!file_.read(reinterpret_cast<char*>(stored_.data()),
+                      stored_.size())) {
+        return false;
+      }
+
+      if (block.stored_size != block.raw_size) {
+        raw.clear();
+        if (!decompress(stored_.data(), stored_.size(), raw) ||
+            raw.size() != block.raw_size) {
+          throw std::runtime_error{"Corrupted trace block."};
+        }
+      } else {
+        raw.swap(stored_);
+      }
+
+      if (block.thread_id != datamon::TraceWriter::module_record) {
+        return true;
+      }
+      add_module(block.event_count, raw);
+    }
+    return false;
+  }
+
+  // decodes the events of a block
+  template <typename TVisit>
+  void decode(const BlockHeader& block, const std::vector<uint8_t>& raw,
+              TVisit&& visit) const {
+    const uint8_t* in = raw.data();
+    const uint8_t* end = raw.data() + raw.size();
+    uint64_t timestamp = 0;
+    uint32_t module = 0;
+    uintptr_t code_offset = 0;
+    uintptr_t offset = 0;
+    for (uint32_t i = 0; i < block.event_count; ++i) {
+      uint64_t first, code, offset_delta;
+      if (!get_varint(in, end, first) || !get_varint(in, end, code)) {
+        throw std::runtime_error{"Corrupted trace block."};
+      }
+
+      if (code == 1) {
+        // the code lies in another module than the previous event's
+        uint64_t module_index;
+        if (!get_varint(in, end, module_index) ||
+            !get_varint(in, end, code)) {
+          throw std::runtime_error{"Corrupted trace block."};
+        }
+        module = static_cast<uint32_t>(module_index);
+        code_offset = code;
+      } else {
+        code_offset += unzigzag(code >> 1);
+      }
+
+      if (!get_varint(in, end, offset_delta)) {
+        throw std::runtime_error{"Corrupted trace block."};
+      }
+
+      timestamp += first >> 1;
+      offset += unzigzag(offset_delta);
+
+      visit(datamon::Event{
+          timestamp,
+          reinterpret_cast<void*>(base_of(module) + code_offset),
+          reinterpret_cast<void*>(header_.address + offset),
+          block.thread_id,
+          (first & 1) != 0,
+      });
+    }
+  }
+
+  // the threads that have blocks in the file, without decoding any
+  std::set<uint32_t> threads() {
+    std::set<uint32_t> threads;
+    BlockHeader block;
+    while (file_.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+      if (block.thread_id != datamon::TraceWriter::module_record) {
+        threads.insert(block.thread_id);
+      }
+      file_.seekg(block.stored_size, std::ios::cur);
+    }
+    return threads;
+  }
+
+  const std::vector<Module>& modules() const { return modules_; }
+
+ private:
+  void add_module(uint32_t index, const std::vector<uint8_t>& raw) {
+    ModuleRecord record;
+    if (raw.size() < sizeof(record)) {
+      throw std::runtime_error{"Corrupted trace block."};
+    }
+    std::memcpy(&record, raw.data(), sizeof(record));
+
+    const std::u8string path{
+        reinterpret_cast<const char8_t*>(raw.data() + sizeof(record)),
+        raw.size() - sizeof(record)};
+    modules_.push_back({index, record.base, record.size, path});
+  }
+
+  uintptr_t base_of(uint32_t module) const {
+    if (module == 0) {
+      // outside of any module, the offset is the address
+      return 0;
+    }
+
+    // indices are handed out in order, so the module is usually at index - 1
+    if (module <= modules_.size() && modules_[module - 1].index == module) {
+      return static_cast<uintptr_t>(modules_[module - 1].base);
+    }
+    for (const Module& candidate : modules_) {
+      if (candidate.index == module) {
+        return static_cast<uintptr_t>(candidate.base);
+      }
+    }
+    throw std::runtime_error{"Corrupted trace block."};
+  }
+
+  std::ifstream file_;
+  FileHeader header_;
+  std::vector<Module> modules_;
+  std::vector<uint8_t> stored_;
+};
+
+}  // namespace
+
+datamon::TraceWriter::TraceWriter(void* address, size_t size,
+                                  const std::filesystem::path& path,
+                                  Options options)
+    : address_(address),
+      size_(size),
+      options_(options),
+      file_(path, std::ios::binary | std::ios::trunc) {
+  const FileHeader header{trace_magic, reinterpret_cast<uint64_t>(address_),
+                          size_};
+  if (!file_.write(reinterpret_cast<const char*>(&header), sizeof(header))) {
+    throw std::runtime_error{"Failed to create trace file."};
+  }
+  bytes_written_ = sizeof(header);
+
+  // the handler locates the accessing code, which can't build the table
+  load_modules();
+
+  writer_ = std::thread{&TraceWriter::write_blocks, this};
+
+  watch_id_ = detail::add_watch(
+      address_, size_, [this](const Event& event) { append(event); },
+      detail::Trap::guard);
+}
+
+datamon::TraceWriter::~TraceWriter() {
+  detail::remove_watch(watch_id_, address_, size_);
+
+  flush();
+
+  {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+  }
+  block_available_.notify_one();
+  writer_.join();
+}
+
+void datamon::TraceWriter::append(const Event& event) {
+  const CodeLocation location = locate(event.accessing_address);
+
+  std::unique_lock lock{mutex_};
+
+  auto block = std::find_if(
+      blocks_.begin(), blocks_.end(),
+      [&](const Block& block) { return block.thread_id == event.thread_id; });
+  if (block == blocks_.end()) {
+    blocks_.push_back({event.thread_id});
+    block = std::prev(blocks_.end());
+    block->bytes.reserve(options_.block_size + 32);
+  }
+
+  const uint32_t module = trace_module(location);
+  const uintptr_t code_offset =
+      module ? location.offset
+             : reinterpret_cast<uintptr_t>(event.accessing_address);
+  const uintptr_t offset = reinterpret_cast<uintptr_t>(event.data) -
+                           reinterpret_cast<uintptr_t>(address_);
+
+  // steady clock timestamps never go back on a thread, so the delta has a
+  // spare bit for the access type
+  put_varint(block->bytes, ((event.timestamp - block->timestamp) << 1) |
+                               (event.read ? 1 : 0));
+  if (module == block->module) {
+    // even, offsets within a module differ by far less than 2^62
+    put_varint(block->bytes,
+               zigzag(static_cast<int64_t>(code_offset - block->code_offset))
+                   << 1);
+  } else {
+    // 1 marks a switch to another module, followed by its offset in full
+    put_varint(block->bytes, 1);
+    put_varint(block->bytes, module);
+    put_varint(block->bytes, code_offset);
+  }
+  put_varint(block->bytes,
+             zigzag(static_cast<int64_t>(offset - block->offset)));
+
+  block->timestamp = event.timestamp;
+  block->module = module;
+  block->code_offset = code_offset;
+  block->offset = offset;
+  ++block->event_count;
+  ++event_count_;
+
+  if (block->bytes.size() >= options_.block_size) {
+    submit(*block);
+  }
+}
+
+uint32_t datamon::TraceWriter::trace_module(const CodeLocation& location) {
+  if (location.module == unknown_module) {
+    return 0;
+  }
+
+  auto it = module_indices_.find(location.module);
+  if (it != module_indices_.end()) {
+    return it->second;
+  }
+
+  const auto module = datamon::module(location.module);
+  if (!module) {
+    // unloaded since the event
+    return 0;
+  }
+
+  const uint32_t index = static_cast<uint32_t>(module_indices_.size() + 1);
+  module_indices_.emplace(location.module, index);
+
+  // queued ahead of the block of the event, which is submitted later
+  Block record{module_record, index};
+  const ModuleRecord payload{module->base, module->size};
+  const std::u8string path = module->path.u8string();
+  record.bytes.resize(sizeof(payload) + path.size());
+  std::memcpy(record.bytes.data(), &payload, sizeof(payload));
+  std::memcpy(record.bytes.data() + sizeof(payload), path.data(), path.size());
+  full_blocks_.push_back(std::move(record));
+  block_available_.notify_one();
+
+  return index;
+}
+
+void datamon::TraceWriter::submit(Block& block) {
+  const uint32_t thread_id = block.thread_id;
+  full_blocks_.push_back(std::move(block));
+
+  // the next block of the thread starts from scratch, so every block can be
+  // decoded on its own
+  block = Block{thread_id};
+  block.bytes.reserve(options_.block_size + 32);
+
+  block_available_.notify_one();
+}
+
+void datamon::TraceWriter::flush() {
+  std::unique_lock lock{mutex_};
+
+  for (Block& block : blocks_) {
+    if (block.event_count) {
+      submit(block);
+    }
+  }
+
+  blocks_written_.wait(
+      lock, [this] { return full_blocks_.empty() && writing_ == 0; });
+}
+
+uint64_t datamon::TraceWriter::event_count() const {
+  std::unique_lock lock{mutex_};
+  return event_count_;
+}
+
+uint64_t datamon::TraceWriter::bytes_written() const {
+  std::unique_lock lock{mutex_};
+  return bytes_written_;
+}
+
+void datamon::TraceWriter::write_blocks() {
+  std::unique_lock lock{mutex_};
+  while (true) {
+    block_available_.wait(
+        lock, [this] { return stopping_ || !full_blocks_.empty(); });
+    if (full_blocks_.empty()) {
+      return;
+    }
+
+    Block block = std::move(full_blocks_.front());
+    full_blocks_.pop_front();
+    ++writing_;
+    lock.unlock();
+
+    std::vector<uint8_t> compressed;
+    const std::vector<uint8_t>* stored = &block.bytes;
+    if (options_.compress) {
+      compressed = compress(block.bytes);
+      if (compressed.size() < block.bytes.size()) {
+        stored = &compressed;
+      }
+    }
+
+    const BlockHeader header{block.thread_id, block.event_count,
+                             static_cast<uint32_t>(block.bytes.size()),
+                             static_cast<uint32_t>(stored->size())};
+    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file_.write(reinterpret_cast<const char*>(stored->data()),
+                stored->size());
+    file_.flush();
+
+    lock.lock();
+    --writing_;
+    bytes_written_ += sizeof(header) + stored->size();
+    blocks_written_.notify_all();
+  }
+}
+
+std::vector<datamon::Event> datamon::TraceWriter::read(
+    const std::filesystem::path& path) {
+  std::vector<Event> events;
+  read(path, [&events](const Event& event) { events.push_back(event); });
+  return events;
+}
+
+void datamon::TraceWriter::read(
+    const std::filesystem::path& path,
+    const std::function<void(const Event& event)>& visit) {
+  TraceFile file{path};
+
+  BlockHeader block;
+  std::vector<uint8_t> raw;
+  while (file.next(block, raw)) {
+    file.decode(block, raw, visit);
+  }
+}
+
+std::vector<datamon::TraceWriter::Module> datamon::TraceWriter::read_modules(
+    const std::filesystem::path& path) {
+  TraceFile file{path};
+
+  // module records precede the blocks that refer to them, so all of them are
+  // known by the end of the file
+  BlockHeader block;
+  std::vector<uint8_t> raw;
+  while (file.next(block, raw)) {
+  }
+  return file.modules();
+}
+
+void datamon::TraceWriter::read_in_order(
+    const std::filesystem::path& path,
+    const std::function<void(const Event& event)>& visit) {
+  // the blocks of each thread are in time order, so merging the threads only
+  // needs the current block of each. every thread reads through the file on
+  // its own, taking in the module records on the way
+  struct Cursor {
+    TraceFile file;
+    uint32_t thread_id;
+    std::vector<uint8_t> raw;
+    std::vector<Event> events;
+    size_t next = 0;
+
+    bool advance() {
+      if (++next < events.size()) {
+        return true;
+      }
+
+      BlockHeader block;
+      events.clear();
+      next = 0;
+      while (events.empty() && file.next(block, raw, thread_id)) {
+        file.decode(block, raw,
+                    [this](const Event& event) { events.push_back(event); });
+      }
+      return !events.empty();
+    }
+  };
+
+  std::vector<std::unique_ptr<Cursor>> cursors;
+  for (uint32_t thread_id : TraceFile{path}.threads()) {
+    cursors.push_back(
+        std::make_unique<Cursor>(Cursor{TraceFile{path}, thread_id}));
+  }
+
+  auto later = [](const Cursor* a, const Cursor* b) {
+    return a->events[a->next].timestamp > b->events[b->next].timestamp;
+  };
+  std::priority_queue<Cursor*, std::vector<Cursor*>, decltype(later)> heap{
+      later};
+  for (auto& cursor : cursors) {
+    // starts out one before the first event
+    cursor->next = SIZE_MAX;
+    if (cursor->advance()) {
+      heap.push(cursor.get());
+    }
+  }
+
+  while (!heap.empty()) {
+    Cursor* cursor = heap.top();
+    heap.pop();
+    visit(cursor->events[cursor->next]);
+    if (cursor->advance()) {
+      heap.push(cursor);
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "event.hpp"
+#include "modules.hpp"
+
+namespace datamon {
+
+//! @brief Writes the accesses to a region to a compact trace file. Each event
+//! is encoded relative to the previous event of the same thread: the
+//! timestamp as a delta, the code address as the module it lies in and a
+//! delta of its offset into that module, and the data address as a delta of
+//! its offset into the region, all varint packed. Code addresses don't
+//! depend on where modules were loaded, so traces of different runs encode
+//! the same code the same way. The events of each thread go into blocks of
+//! their own, and full blocks are optionally compressed and written on a
+//! background thread, so the handler only appends a few bytes per event.
+//!
+//! The file starts with a header holding the region, followed by blocks that
+//! each start with a BlockHeader. Each module is described by a module
+//! record, a block of its own, ahead of the first block that refers to it.
+//! read() decodes a trace file.
+class TraceWriter {
+ public:
+  struct Options {
+    //! The size of the per-thread blocks, before compression.
+    size_t block_size = 64 * 1024;
+    //! Whether to LZ compress full blocks. Blocks that don't shrink are
+    //! stored as is.
+    bool compress = true;
+  };
+
+  //! @brief A module code addresses in a trace are relative to.
+  struct Module {
+    //! The number the trace refers to the module by, starting at 1.
+    uint32_t index;
+    //! Where the module was loaded in the traced process.
+    uint64_t base;
+    uint64_t size;
+    std::filesystem::path path;
+  };
+
+  //! @brief The thread_id of module records.
+  static constexpr uint32_t module_record = UINT32_MAX;
+
+  //! @brief The header in front of each block.
+  struct BlockHeader {
+    //! The thread of the events, or module_record.
+    uint32_t thread_id;
+    //! The number of events, or the index of the module of a module record.
+    uint32_t event_count;
+    uint32_t raw_size;
+    //! The size of the block in the file. Differs from raw_size if and only
+    //! if the block is compressed.
+    uint32_t stored_size;
+  };
+
+  //! @brief Starts tracing the accesses to a region.
+  //! @param address The start of the region to be traced.
+  //! @param size The size of the region to be traced.
+  //! @param path The trace file. It is overwritten if it exists.
+  TraceWriter(void* address, size_t size, const std::filesystem::path& path)
+      : TraceWriter(address, size, path, Options{}) {}
+  TraceWriter(void* address, size_t size, const std::filesystem::path& path,
+              Options options);
+  ~TraceWriter();
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter(TraceWriter&&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  TraceWriter& operator=(TraceWriter&&) = delete;
+
+  //! @brief Writes out the partially filled blocks and waits until
+  //! everything traced so far is in the file.
+  void flush();
+
+  //! @brief The number of events traced so far.
+  uint64_t event_count() const;
+
+  //! @brief The number of bytes written to the file so far.
+  uint64_t bytes_written() const;
+
+  //! @brief Decodes a trace file. Events are in file order, which is in order
+  //! per thread but not across threads. Code addresses are rebased onto the
+  //! modules as they were loaded in the traced process.
+  static std::vector<Event> read(const std::filesystem::path& path);
+
+  //! @brief Decodes a trace file one block at a time, so traces of any size
+  //! can be processed.
+  //! @param visit Called for every event, in file order.
+  static void read(const std::filesystem::path& path,
+                   const std::function<void(const Event& event)>& visit);
+
+  //! @brief Decodes a trace file in timestamp order across threads. Each
+  //! thread's blocks are merged as they are read, so only one block per
+  //! thread is held in memory at a time.
+  //! @param visit Called for every event, in timestamp order.
+  static void read_in_order(
+      const std::filesystem::path& path,
+      const std::function<void(const Event& event)>& visit);
+
+  //! @brief The modules the code addresses of a trace file lie in, e.g. to
+  //! turn them into a module and an offset comparable across runs.
+  static std::vector<Module> read_modules(const std::filesystem::path& path);
+
+ private:
+  struct Block {
+    uint32_t thread_id;
+    uint32_t event_count = 0;
+    std::vector<uint8_t> bytes;
+
+    // the previous event of the block, which the next one is encoded against
+    uint64_t timestamp = 0;
+    uint32_t module = 0;
+    uintptr_t code_offset = 0;
+    uintptr_t offset = 0;
+  };
+
+  void append(const Event& event);
+  // the index of the module of a code location in the trace. writes the
+  // module record when the module is first seen, 0 for code outside modules
+  uint32_t trace_module(const CodeLocation& location);
+  // queues a block for writing and starts a new one for the thread
+  void submit(Block& block);
+  void write_blocks();
+
+  void* address_;
+  size_t size_;
+  Options options_;
+
+  mutable std::mutex mutex_;
+  // the block being filled by each thread
+  std::vector<Block> blocks_;
+  std::deque<Block> full_blocks_;
+  // the trace's module indices by module id
+  std::unordered_map<uint32_t, uint32_t> module_indices_;
+  uint64_t event_count_ = 0;
+  uint64_t bytes_written_ = 0;
+  // the number of blocks taken by the background thread but not written yet
+  size_t writing_ = 0;
+  bool stopping_ = false;
+  std::condition_variable block_available_;
+  std::condition_variable blocks_written_;
+
+  std::ofstream file_;
+  std::thread writer_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
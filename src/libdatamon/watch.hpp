@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "context.hpp"
+#include "event.hpp"
+#include "interval_tree.hpp"
+#include "libdatamon.hpp"
+#include "pc_filter.hpp"
+#include "thread_filter.hpp"
+
+// internal interface between the exception handler and the monitors built on
+// top of it. everything in here is implemented in libdatamon.cpp.
+
+namespace datamon::detail {
+
+//! @brief How the handler treats the pages of a watch after they were hit.
+enum class Trap {
+  //! PAGE_GUARD, restored after the faulting instruction has executed.
+  guard,
+  //! PAGE_GUARD, left cleared after the first hit on each page.
+  guard_once,
+  //! The owner of the watch sets the pages to PAGE_NOACCESS itself and lifts
+  //! the protection of the hit page from its FaultFn, registered with
+  //! add_no_access_watch. The access is retried only if a callback handled
+  //! it, otherwise it is passed on as an access violation.
+  no_access,
+  //! The owner of the watch write protects the pages with arm_writes. Only
+  //! writes are trapped. A write disarms the hit page for every write watch
+  //! on it, all of them are called, and the page stays writable until an
+  //! owner arms it again.
+  write_once,
+  //! Never armed. The accesses are reported by instrumented code through
+  //! report instead of faults. The owner holds on to the watch, so it can't
+  //! be filtered or paused.
+  instrumented,
+};
+
+//! @brief Called from the exception handler for every access that lands
+//! inside a watch. Runs with the lock of the watch's context held.
+using WatchFn = std::function<void(const Event& event)>;
+
+//! @brief Called once the instruction that wrote to a Trap::guard watch has
+//! executed, before the guard is restored and without any handler lock held,
+//! so it may read the written data and add or remove watches.
+//! @param event The event of the write.
+using StepFn = std::function<void(const Event& event)>;
+
+//! @brief Called from the exception handler for every access that lands
+//! inside a Trap::no_access watch. Runs without the lock of the watch's
+//! context, so faults on different pages are handled in parallel, but the
+//! watch isn't removed until it returns.
+//! @return Whether the access can be retried, i.e. the page has been made
+//! accessible for it.
+using FaultFn = std::function<bool(const Event& event)>;
+
+//! @brief The value stored for each watch in the interval tree.
+struct Watch {
+  WatchFn fn;
+  Trap trap;
+  StepFn after_write;
+  // the callback of a Trap::no_access watch, instead of fn
+  FaultFn fault;
+};
+
+//! @brief A watch that was merged into a shared tree entry with the adjacent
+//! and overlapping watches of the same interceptor.
+struct CoalescedWatch {
+  uintptr_t start, last;
+  // the id of the entry it was merged into
+  size_t node;
+};
+
+//! @brief A tree entry spanning coalesced watches.
+struct CoalescedNode {
+  uintptr_t start, last;
+  InterceptorFn interceptor;
+  // the ids of the watches merged into it
+  std::vector<size_t> members;
+};
+
+//! @brief The filters of a watch. Either may be null.
+struct Filters {
+  std::shared_ptr<const PcFilter> code;
+  std::shared_ptr<const ThreadFilter> threads;
+};
+
+//! @brief The state behind a Context.
+struct ContextState {
+  // serializes the callbacks of the context's watches
+  std::mutex mutex;
+  IntervalTree<Watch> tree;
+  // the shards and ids of the watches' routes in the routing index, by
+  // watch id
+  std::unordered_map<size_t, std::vector<std::pair<size_t, size_t>>> routes;
+  // the filters of the watches that have any, by watch id
+  std::unordered_map<size_t, Filters> filters;
+  // the watches that are paused. they keep their entries in the tree but
+  // have no routes, so their pages are left alone
+  std::unordered_set<size_t> paused;
+  // the coalesced watches by their own id, and the entries they were merged
+  // into by entry id
+  std::unordered_map<size_t, CoalescedWatch> coalesced;
+  std::unordered_map<size_t, CoalescedNode> nodes;
+
+  // the tags a thread needs at least one of for any of the watches to accept
+  // its accesses, or all tags if some watch accepts threads regardless of
+  // their tags. read by the handler without the lock, so it can skip the
+  // context for threads none of the watches accept
+  std::atomic<uint64_t> required_tags = ~uint64_t{0};
+
+  std::atomic<uint32_t> sample_every = 1;
+  std::atomic<uint64_t> sample_counter = 0;
+
+  std::atomic<uint64_t> faults = 0;
+  std::atomic<uint64_t> delivered = 0;
+  std::atomic<uint64_t> sampled_out = 0;
+
+  //! @brief Whether any of the watches may accept an access from a thread
+  //! with the given tags.
+  bool may_accept(uint64_t thread_tags) const {
+    const uint64_t required = required_tags.load(std::memory_order_relaxed);
+    return required == ~uint64_t{0} || (thread_tags & required) != 0;
+  }
+
+  //! @brief Counts a fault and returns whether its events should be
+  //! delivered.
+  //! @param persistent Whether the fault hit persistent watches, the only
+  //! ones that are sampled.
+  bool sample(bool persistent) {
+    faults.fetch_add(1, std::memory_order_relaxed);
+
+    const uint32_t every = sample_every.load(std::memory_order_relaxed);
+    if (!persistent || every <= 1 ||
+        sample_counter.fetch_add(1, std::memory_order_relaxed) % every == 0) {
+      delivered.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    sampled_out.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+};
+
+//! @brief Returns the system page size.
+size_t page_size();
+
+//! @brief Registers a watch over [address, address + size) and arms its
+//! pages, unless the trap leaves that to the owner.
+//! @return The id of the watch, to be passed to remove_watch.
+size_t add_watch(void* address, size_t size, WatchFn fn, Trap trap,
+                 Context& context = Context::global(),
+                 StepFn after_write = {});
+
+//! @brief Registers a Trap::no_access watch. Its pages are protected by the
+//! owner.
+//! @return The id of the watch, to be passed to remove_watch.
+size_t add_no_access_watch(void* address, size_t size, FaultFn fn,
+                           Context& context = Context::global());
+
+//! @brief Registers a Trap::guard watch that calls an interceptor. It shares
+//! a single tree entry with the adjacent and overlapping watches of the same
+//! interceptor in the context, so a fault on fragmented watches is dispatched
+//! once instead of once per watch, and the interceptor is called once even if
+//! several of them contain the data. The id stays valid for remove_watch and
+//! remove_watches however the entries are merged and split. Coalesced
+//! watches can't be filtered or paused.
+size_t add_coalesced_watch(void* address, size_t size,
+                           InterceptorFn interceptor,
+                           Context& context = Context::global());
+
+//! @brief Sets or clears the code filter of a watch. Accesses the filter
+//! rejects are not reported to Trap::guard watches; the pages are re-armed
+//! as usual. The other traps always see every access since their owners
+//! depend on it.
+void set_filter(size_t id, std::shared_ptr<const PcFilter> filter,
+                Context& context = Context::global());
+
+//! @brief Sets or clears the thread filter of a watch. Applies to the same
+//! traps as set_filter.
+void set_thread_filter(size_t id, std::shared_ptr<const ThreadFilter> filter,
+                       Context& context = Context::global());
+
+//! @brief Disarms the pages of a watch and unregisters it.
+void remove_watch(size_t id, void* address, size_t size,
+                  Context& context = Context::global());
+
+//! @brief A watch to be removed by remove_watches.
+struct WatchRef {
+  size_t id;
+  void* address;
+  size_t size;
+};
+
+//! @brief Removes several watches of a context at once. Adjacent and
+//! overlapping ranges are disarmed with a single protection change, and the
+//! locks are taken once for all of them.
+void remove_watches(const std::vector<WatchRef>& watches,
+                    Context& context = Context::global());
+
+//! @brief Pauses several watches of a context at once without unregistering
+//! them. The guards of their pages are lifted in as few protection changes
+//! as possible, except on pages that other watches still guard. Only for
+//! Trap::guard watches.
+void pause_watches(const std::vector<WatchRef>& watches,
+                   Context& context = Context::global());
+
+//! @brief Resumes paused watches and re-arms their pages.
+void resume_watches(const std::vector<WatchRef>& watches,
+                    Context& context = Context::global());
+
+//! @brief Write protects the pages of a range for write_once watches. Pages
+//! are reference counted, so several owners can arm the same page.
+void arm_writes(void* address, size_t size);
+
+//! @brief Releases the write protection an owner holds on the pages of a
+//! range. Must only be called for pages the owner still has armed.
+void disarm_writes(void* address, size_t size);
+
+}  // namespace datamon::detail
\ No newline at end of file
@@ -0,0 +1,116 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "watch_group.hpp"
+
+#include <vector>
+
+namespace {
+
+std::mutex& group_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// the existing groups by name
+std::unordered_map<std::string_view, datamon::WatchGroup*>& groups() {
+  static std::unordered_map<std::string_view, datamon::WatchGroup*> groups;
+  return groups;
+}
+
+}  // namespace
+
+datamon::WatchGroup::WatchGroup(std::string name, Context& context)
+    : name_(std::move(name)), context_(context) {
+  std::unique_lock lock{group_mutex()};
+  if (!groups().try_emplace(name_, this).second) {
+    throw std::runtime_error{"A watch group with this name already exists."};
+  }
+}
+
+datamon::WatchGroup::~WatchGroup() {
+  {
+    std::unique_lock lock{group_mutex()};
+    groups().erase(name_);
+  }
+
+  std::vector<detail::WatchRef> watches;
+  for (const auto& [id, watch] : watches_) {
+    watches.push_back(watch);
+  }
+  detail::remove_watches(watches, context_);
+}
+
+datamon::WatchGroup* datamon::WatchGroup::find(std::string_view name) {
+  std::unique_lock lock{group_mutex()};
+  auto it = groups().find(name);
+  return it != groups().end() ? it->second : nullptr;
+}
+
+size_t datamon::WatchGroup::add(void* address, size_t size,
+                                InterceptorFn interceptor) {
+  std::unique_lock lock{mutex_};
+
+  const size_t id = detail::add_watch(
+      address, size,
+      [this, interceptor](const Event& event) {
+        if (!paused_.load(std::memory_order_relaxed)) {
+          interceptor(event.accessing_address, event.read, event.data);
+        }
+      },
+      detail::Trap::guard, context_);
+
+  const detail::WatchRef watch{id, address, size};
+  watches_.emplace(id, watch);
+
+  if (paused_) {
+    detail::pause_watches({watch}, context_);
+  }
+
+  return id;
+}
+
+void datamon::WatchGroup::remove(size_t handle) {
+  std::unique_lock lock{mutex_};
+
+  auto it = watches_.find(handle);
+  if (it == watches_.end()) {
+    return;
+  }
+
+  detail::remove_watch(it->second.id, it->second.address, it->second.size,
+                       context_);
+  watches_.erase(it);
+}
+
+void datamon::WatchGroup::pause() {
+  std::unique_lock lock{mutex_};
+  if (paused_.exchange(true)) {
+    return;
+  }
+
+  std::vector<detail::WatchRef> watches;
+  for (const auto& [id, watch] : watches_) {
+    watches.push_back(watch);
+  }
+  detail::pause_watches(watches, context_);
+}
+
+void datamon::WatchGroup::resume() {
+  std::unique_lock lock{mutex_};
+  if (!paused_.exchange(false)) {
+    return;
+  }
+
+  std::vector<detail::WatchRef> watches;
+  for (const auto& [id, watch] : watches_) {
+    watches.push_back(watch);
+  }
+  detail::resume_watches(watches, context_);
+}
+
+size_t datamon::WatchGroup::size() const {
+  std::unique_lock lock{mutex_};
+  return watches_.size();
+}
\ No newline at end of file
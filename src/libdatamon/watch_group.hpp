@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "context.hpp"
+#include "libdatamon.hpp"
+#include "watch.hpp"
+
+namespace datamon {
+
+//! @brief A named set of watches that can be paused and resumed as a unit,
+//! e.g. around the latency critical phases of a request loop. Pausing keeps
+//! the watches registered and only lifts the guards of their pages, in one
+//! batch and as few protection changes as possible, so toggling a group is
+//! much cheaper than destroying and recreating its watches. Faults see
+//! either all of a group's watches or none of them.
+//!
+//! @code
+//! datamon::WatchGroup group{"session"};
+//! group.add(&session, sizeof(session), interceptor);
+//!
+//! group.pause();
+//! handle_request();  // not monitored
+//! group.resume();
+//! @endcode
+class WatchGroup {
+ public:
+  //! @brief Creates a new, running group.
+  //! @param name The name to find the group by. Has to be unique among the
+  //! existing groups.
+  //! @param context The context to register the watches in. It has to outlive
+  //! the group.
+  explicit WatchGroup(std::string name, Context& context = Context::global());
+  //! @brief Removes the watches of the group.
+  ~WatchGroup();
+
+  WatchGroup(const WatchGroup&) = delete;
+  WatchGroup(WatchGroup&&) = delete;
+  WatchGroup& operator=(const WatchGroup&) = delete;
+  WatchGroup& operator=(WatchGroup&&) = delete;
+
+  //! @brief The group with the given name, or nullptr if there is none.
+  static WatchGroup* find(std::string_view name);
+
+  const std::string& name() const { return name_; }
+
+  //! @brief Adds a watch to the group. It starts out paused if the group is.
+  //! @param address The address of the data to be monitored.
+  //! @param size The size of the data to be monitored.
+  //! @param interceptor The interceptor callback function to call when the
+  //! data is accessed.
+  //! @return A handle to remove the watch with.
+  size_t add(void* address, size_t size, InterceptorFn interceptor);
+
+  //! @brief Removes a watch from the group.
+  void remove(size_t handle);
+
+  //! @brief Stops monitoring all watches of the group.
+  void pause();
+
+  //! @brief Monitors all watches of the group again.
+  void resume();
+
+  //! @brief Whether the group is paused.
+  bool paused() const { return paused_.load(); }
+
+  //! @brief The number of watches in the group.
+  size_t size() const;
+
+ private:
+  std::string name_;
+  Context& context_;
+
+  // serializes changes to the group
+  mutable std::mutex mutex_;
+  // the watches of the group, by the ID of their entry in the interval tree
+  std::unordered_map<size_t, detail::WatchRef> watches_;
+  // also checked by the callbacks, for faults that raced with a pause
+  std::atomic<bool> paused_ = false;
+};
+
+}  // namespace datamon
\ No newline at end of file
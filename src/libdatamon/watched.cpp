@@ -0,0 +1,33 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "watched.hpp"
+
+#include <intrin.h>
+
+#include "watch.hpp"
+
+datamon::detail::InstrumentedWatch datamon::detail::add_instrumented_watch(
+    void* address, size_t size, InterceptorFn interceptor, Context& context) {
+  // registered for the bookkeeping of the context only. the accessors report
+  // to the interceptor directly, so the entry has no callback
+  const size_t id = add_watch(address, size, {}, Trap::instrumented, context);
+  return {interceptor, &context, id};
+}
+
+void datamon::detail::remove_instrumented_watch(const InstrumentedWatch& watch,
+                                                void* address, size_t size) {
+  remove_watch(watch.id, address, size, *watch.context);
+}
+
+void datamon::detail::report(const InstrumentedWatch& watch, void* data,
+                             bool read) {
+  if (!watch.context->state().sample(true)) {
+    return;
+  }
+
+  // inside the code that performed the access, since the accessors that
+  // call us are inlined
+  watch.interceptor(_ReturnAddress(), read, data);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "context.hpp"
+#include "libdatamon.hpp"
+
+// define DATAMON_DISABLE_INSTRUMENTATION to compile watched<T> down to the
+// bare value, without registering or reporting anything
+
+namespace datamon {
+
+namespace detail {
+
+//! @brief An instrumented watch, resolved once when it is added.
+struct InstrumentedWatch {
+  InterceptorFn interceptor;
+  Context* context;
+  // the ID of the watch entry in the interval tree
+  size_t id;
+};
+
+//! @brief Registers an instrumented watch. Its pages are never armed, the
+//! accesses are reported by the instrumented code through report.
+InstrumentedWatch add_instrumented_watch(void* address, size_t size,
+                                         InterceptorFn interceptor,
+                                         Context& context);
+
+//! @brief Unregisters an instrumented watch.
+void remove_instrumented_watch(const InstrumentedWatch& watch, void* address,
+                               size_t size);
+
+//! @brief Reports an access to an instrumented watch, the same way the
+//! exception handler reports a fault. The watch is known already, so this
+//! only samples through the context's atomic counters and calls the
+//! interceptor, without locking or allocating. The accessing address is the
+//! return address of the call, which lies in the code performing the access
+//! once the accessor is inlined.
+void report(const InstrumentedWatch& watch, void* data, bool read);
+
+}  // namespace detail
+
+//! @brief A value whose accessors report every read and write to the same
+//! interceptors and contexts as Datamon, without page faults. Meant for code
+//! you own: each wrapped field is watched exactly, independent of the page it
+//! lives on, and an access costs a call instead of two exceptions.
+//!
+//! A compound assignment is reported as a single write, like the single
+//! instruction a page guard would trap. The interceptor is called on the
+//! accessing thread without the context's lock, so accesses from different
+//! threads may call it concurrently.
+//!
+//! @code
+//! struct Player {
+//!   datamon::watched<int> health{interceptor, 100};
+//!   float speed;  // not watched
+//! };
+//! @endcode
+template <typename T>
+class watched {
+ public:
+  //! @brief Creates a new watched value.
+  //! @param interceptor The interceptor callback function to call when the
+  //! value is accessed.
+  //! @param value The initial value. Initializing it is not reported.
+  explicit watched(InterceptorFn interceptor, T value = T{})
+      : watched(Context::global(), interceptor, std::move(value)) {}
+
+  //! @brief Creates a new watched value in the given context.
+  //! @param context The context to register the watch in. It has to outlive
+  //! the value.
+  //! @param interceptor The interceptor callback function to call when the
+  //! value is accessed.
+  //! @param value The initial value. Initializing it is not reported.
+  watched(Context& context, InterceptorFn interceptor, T value = T{})
+      : value_(std::move(value)) {
+#ifndef DATAMON_DISABLE_INSTRUMENTATION
+    watch_ = detail::add_instrumented_watch(&value_, sizeof(T), interceptor,
+                                            context);
+#else
+    (void)context;
+    (void)interceptor;
+#endif
+  }
+
+  ~watched() {
+#ifndef DATAMON_DISABLE_INSTRUMENTATION
+    detail::remove_instrumented_watch(watch_, &value_, sizeof(T));
+#endif
+  }
+
+  watched(const watched&) = delete;
+  watched(watched&&) = delete;
+  watched& operator=(const watched&) = delete;
+  watched& operator=(watched&&) = delete;
+
+  //! @brief Reads the value.
+  T get() const {
+    report(true);
+    return value_;
+  }
+
+  //! @brief Writes the value.
+  void set(T value) {
+    report(false);
+    value_ = std::move(value);
+  }
+
+  operator T() const { return get(); }
+
+  watched& operator=(T value) {
+    set(std::move(value));
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator+=(const U& other) {
+    report(false);
+    value_ += other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator-=(const U& other) {
+    report(false);
+    value_ -= other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator*=(const U& other) {
+    report(false);
+    value_ *= other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator/=(const U& other) {
+    report(false);
+    value_ /= other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator|=(const U& other) {
+    report(false);
+    value_ |= other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator&=(const U& other) {
+    report(false);
+    value_ &= other;
+    return *this;
+  }
+
+  template <typename U>
+  watched& operator^=(const U& other) {
+    report(false);
+    value_ ^= other;
+    return *this;
+  }
+
+  watched& operator++() {
+    report(false);
+    ++value_;
+    return *this;
+  }
+
+  T operator++(int) {
+    report(false);
+    return value_++;
+  }
+
+  watched& operator--() {
+    report(false);
+    --value_;
+    return *this;
+  }
+
+  T operator--(int) {
+    report(false);
+    return value_--;
+  }
+
+  //! @brief The value itself, for accesses that should not be reported.
+  T& unwatched() { return value_; }
+  const T& unwatched() const { return value_; }
+
+  //! @brief The address of the watched value.
+  void* address() const { return const_cast<T*>(&value_); }
+
+  //! @brief The size of the watched value.
+  size_t size() const { return sizeof(T); }
+
+ private:
+  void report(bool read) const {
+#ifndef DATAMON_DISABLE_INSTRUMENTATION
+    detail::report(watch_, const_cast<T*>(&value_), read);
+#else
+    (void)read;
+#endif
+  }
+
+  T value_;
+
+#ifndef DATAMON_DISABLE_INSTRUMENTATION
+  detail::InstrumentedWatch watch_;
+#endif
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,65 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "watching_allocator.hpp"
+
+#include "watch.hpp"
+
+datamon::detail::BufferWatch::~BufferWatch() { disarm(); }
+
+void datamon::detail::BufferWatch::allocated(void* address, size_t size) {
+  if (armed_.address) {
+    // the container is about to move its elements over. stop watching the old
+    // buffer now and watch the new one once the old one is gone
+    moving_from_ = armed_;
+    disarm();
+    pending_ = {address, size};
+  } else if (moving_from_.address) {
+    // another allocation in the middle of a move, only the latest buffer is
+    // kept
+    pending_ = {address, size};
+  } else {
+    arm({address, size});
+  }
+}
+
+void datamon::detail::BufferWatch::deallocated(void* address) {
+  if (address == armed_.address) {
+    // the container released its storage without replacing it
+    disarm();
+  } else if (address == moving_from_.address) {
+    // the elements have been moved, watch the new buffer
+    moving_from_ = {};
+    if (pending_.address) {
+      arm(pending_);
+      pending_ = {};
+    }
+  } else if (address == pending_.address) {
+    // the reallocation was abandoned and the elements stay where they were
+    pending_ = {};
+    if (moving_from_.address) {
+      arm(moving_from_);
+      moving_from_ = {};
+    }
+  }
+}
+
+void datamon::detail::BufferWatch::arm(Buffer buffer) {
+  watch_id_ = add_watch(
+      buffer.address, buffer.size,
+      [interceptor = interceptor_](const Event& event) {
+        interceptor(event.accessing_address, event.read, event.data);
+      },
+      Trap::guard, context_);
+  armed_ = buffer;
+}
+
+void datamon::detail::BufferWatch::disarm() {
+  if (!armed_.address) {
+    return;
+  }
+
+  remove_watch(watch_id_, armed_.address, armed_.size, context_);
+  armed_ = {};
+}
\ No newline at end of file
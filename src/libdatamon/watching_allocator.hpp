@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "context.hpp"
+#include "libdatamon.hpp"
+
+namespace datamon {
+
+namespace detail {
+
+//! @brief Keeps the single buffer of a container watched across
+//! reallocations, driven by the hooks of WatchingAllocator.
+class BufferWatch {
+ public:
+  BufferWatch(InterceptorFn interceptor, Context& context)
+      : interceptor_(interceptor), context_(context) {}
+  ~BufferWatch();
+
+  BufferWatch(const BufferWatch&) = delete;
+  BufferWatch(BufferWatch&&) = delete;
+  BufferWatch& operator=(const BufferWatch&) = delete;
+  BufferWatch& operator=(BufferWatch&&) = delete;
+
+  //! @brief Called after the container allocated a buffer.
+  void allocated(void* address, size_t size);
+
+  //! @brief Called before the container frees a buffer.
+  void deallocated(void* address);
+
+  InterceptorFn interceptor() const { return interceptor_; }
+  Context& context() const { return context_; }
+
+  //! @brief The watched buffer, or nullptr while there is none.
+  void* address() const { return armed_.address; }
+
+  //! @brief The size of the watched buffer.
+  size_t size() const { return armed_.size; }
+
+ private:
+  struct Buffer {
+    void* address = nullptr;
+    size_t size = 0;
+  };
+
+  void arm(Buffer buffer);
+  void disarm();
+
+  InterceptorFn interceptor_;
+  Context& context_;
+
+  // the watched buffer
+  Buffer armed_;
+  // the previous buffer, left unwatched while the elements move out of it
+  Buffer moving_from_;
+  // the new buffer, watched once the previous one is freed
+  Buffer pending_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_ = 0;
+};
+
+}  // namespace detail
+
+//! @brief Whether containers allocate objects of a type on the side of their
+//! storage, e.g. bookkeeping. WatchingAllocator passes such allocations
+//! through unwatched. Specialize it for the node or proxy types of other
+//! containers.
+template <typename T>
+struct is_container_bookkeeping : std::false_type {};
+
+#ifdef _MSVC_STL_VERSION
+// the iterator debugging proxy of MSVC debug builds
+template <>
+struct is_container_bookkeeping<std::_Container_proxy> : std::true_type {};
+#endif
+
+//! @brief An allocator that keeps the storage of a container watched, for
+//! containers that keep their elements in a single buffer (vectors, strings,
+//! open addressing hash maps). When the container reallocates, the old buffer
+//! is unwatched as soon as the new one is allocated, so moving the elements
+//! over isn't reported, and the new buffer is watched in one go when the old
+//! one is freed. Small strings that live inside the string object itself are
+//! not watched.
+//!
+//! Copies and rebinds of the allocator share the watch, so one allocator
+//! instance must only serve one container. Rebinds matter for hash maps,
+//! which allocate their slot array through an allocator rebound to their
+//! slot type. Allocations of bookkeeping types (see is_container_bookkeeping)
+//! are not watched. Copy constructing a container gives the copy a watch of
+//! its own.
+//!
+//! @code
+//! datamon::WatchedVector<int> v{datamon::WatchingAllocator<int>{interceptor}};
+//!
+//! using Allocator = datamon::WatchingAllocator<std::pair<const int, int>>;
+//! absl::flat_hash_map<int, int, absl::Hash<int>, std::equal_to<int>,
+//!                     Allocator>
+//!     map{0, {}, {}, Allocator{interceptor}};
+//! @endcode
+template <typename T>
+class WatchingAllocator {
+ public:
+  using value_type = T;
+
+  //! @brief Creates a new allocator.
+  //! @param interceptor The interceptor callback function to call when the
+  //! container's storage is accessed.
+  //! @param context The context to register the watch in. It has to outlive
+  //! the container.
+  explicit WatchingAllocator(InterceptorFn interceptor,
+                             Context& context = Context::global())
+      : watch_(std::make_shared<detail::BufferWatch>(interceptor, context)) {}
+
+  template <typename U>
+  WatchingAllocator(const WatchingAllocator<U>& other) : watch_(other.watch_) {}
+
+  T* allocate(size_t count) {
+    T* address = std::allocator<T>{}.allocate(count);
+    if constexpr (tracking) {
+      watch_->allocated(address, count * sizeof(T));
+    }
+    return address;
+  }
+
+  void deallocate(T* address, size_t count) {
+    if constexpr (tracking) {
+      watch_->deallocated(address);
+    }
+    std::allocator<T>{}.deallocate(address, count);
+  }
+
+  WatchingAllocator select_on_container_copy_construction() const {
+    return WatchingAllocator{watch_->interceptor(), watch_->context()};
+  }
+
+  //! @brief The start of the watched storage, or nullptr while there is none.
+  void* address() const { return watch_->address(); }
+
+  //! @brief The size of the watched storage.
+  size_t size() const { return watch_->size(); }
+
+  template <typename U>
+  bool operator==(const WatchingAllocator<U>& other) const {
+    return watch_ == other.watch_;
+  }
+
+ private:
+  template <typename U>
+  friend class WatchingAllocator;
+
+  // whether the allocations are the container's storage
+  static constexpr bool tracking = !is_container_bookkeeping<T>::value;
+
+  std::shared_ptr<detail::BufferWatch> watch_;
+};
+
+//! @brief A vector whose storage stays watched when it grows.
+template <typename T>
+using WatchedVector = std::vector<T, WatchingAllocator<T>>;
+
+//! @brief A string whose heap storage stays watched when it grows.
+using WatchedString =
+    std::basic_string<char, std::char_traits<char>, WatchingAllocator<char>>;
+
+}  // namespace datamon
\ No newline at end of file
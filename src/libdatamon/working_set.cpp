@@ -0,0 +1,88 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "working_set.hpp"
+
+#include "watch.hpp"
+
+datamon::WorkingSet::WorkingSet(void* address, size_t size) {
+  const size_t page_size = detail::page_size();
+  const uintptr_t address_value = reinterpret_cast<uintptr_t>(address);
+
+  // widen the region to whole pages
+  base_ = address_value & ~(page_size - 1);
+  page_count_ = (address_value + size - base_ + page_size - 1) / page_size;
+
+  // allocate everything up front so the handler never has to
+  touched_.resize(page_count_);
+  touch_order_.reserve(page_count_);
+
+  watch_id_ = detail::add_watch(
+      base(), page_count_ * page_size,
+      [this, page_size](const Event& event) {
+        const size_t page =
+            (reinterpret_cast<uintptr_t>(event.data) - base_) / page_size;
+
+        std::unique_lock lock{mutex_};
+
+        // the page might still be hit again if another watch keeps re-arming
+        // it, only the first touch is interesting
+        if (touched_[page]) {
+          return;
+        }
+
+        touched_[page] = true;
+        touch_order_.push_back(
+            {page, event.timestamp, event.accessing_address, event.read});
+      },
+      detail::Trap::guard_once);
+}
+
+datamon::WorkingSet::~WorkingSet() {
+  detail::remove_watch(watch_id_, base(), page_count_ * detail::page_size());
+}
+
+size_t datamon::WorkingSet::touched_count() const {
+  std::unique_lock lock{mutex_};
+  return touch_order_.size();
+}
+
+std::vector<bool> datamon::WorkingSet::touched() const {
+  std::unique_lock lock{mutex_};
+  return touched_;
+}
+
+std::vector<datamon::WorkingSet::Touch> datamon::WorkingSet::touch_order()
+    const {
+  std::unique_lock lock{mutex_};
+  return touch_order_;
+}
+
+std::vector<std::pair<void*, size_t>> datamon::WorkingSet::untouched_ranges()
+    const {
+  std::unique_lock lock{mutex_};
+
+  const size_t page_size = detail::page_size();
+
+  std::vector<std::pair<void*, size_t>> ranges;
+  size_t page = 0;
+  while (page < page_count_) {
+    if (touched_[page]) {
+      ++page;
+      continue;
+    }
+
+    // coalesce the run of untouched pages starting here
+    size_t run_end = page;
+    while (run_end < page_count_ && !touched_[run_end]) {
+      ++run_end;
+    }
+
+    ranges.emplace_back(reinterpret_cast<void*>(base_ + page * page_size),
+                        (run_end - page) * page_size);
+    page = run_end;
+  }
+
+  return ranges;
+}
\ No newline at end of file
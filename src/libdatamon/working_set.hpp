@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Records which pages of a region are touched, and in which order.
+//! Every page is armed once and left disarmed after its first access, so
+//! monitoring costs at most one exception per page. Since the page is the
+//! unit of tracking, the region is widened to whole pages.
+class WorkingSet {
+ public:
+  //! @brief The first access to a page.
+  struct Touch {
+    //! The index of the page within the region.
+    size_t page;
+    //! Steady clock time of the access, in nanoseconds.
+    uint64_t timestamp;
+    //! The address of the code that touched the page.
+    void* accessing_address;
+    //! Whether the first access was a read or a write.
+    bool read;
+  };
+
+  //! @brief Starts tracking the pages of a region.
+  //! @param address The start of the region to be tracked.
+  //! @param size The size of the region to be tracked.
+  WorkingSet(void* address, size_t size);
+  ~WorkingSet();
+
+  WorkingSet(const WorkingSet&) = delete;
+  WorkingSet(WorkingSet&&) = delete;
+  WorkingSet& operator=(const WorkingSet&) = delete;
+  WorkingSet& operator=(WorkingSet&&) = delete;
+
+  //! @brief The address of the first tracked page.
+  void* base() const { return reinterpret_cast<void*>(base_); }
+
+  //! @brief The number of tracked pages.
+  size_t page_count() const { return page_count_; }
+
+  //! @brief The number of pages touched so far.
+  size_t touched_count() const;
+
+  //! @brief A bitmap with one entry per page, set if the page was touched.
+  std::vector<bool> touched() const;
+
+  //! @brief The first touch of each touched page, in the order they happened.
+  std::vector<Touch> touch_order() const;
+
+  //! @brief The runs of pages that were never touched, as (address, size)
+  //! pairs. These are the candidates for trimming or lazy loading.
+  std::vector<std::pair<void*, size_t>> untouched_ranges() const;
+
+ private:
+  uintptr_t base_;
+  size_t page_count_;
+
+  mutable std::mutex mutex_;
+  std::vector<bool> touched_;
+  std::vector<Touch> touch_order_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file
@@ -0,0 +1,123 @@
+// clang-format off
+#include "pch.hpp"
+// clang-format on
+
+#include "write_journal.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "watch.hpp"
+
+namespace {
+
+uint64_t read_value(uintptr_t data, uint8_t size) {
+  uint64_t value = 0;
+  std::memcpy(&value, reinterpret_cast<const void*>(data), size);
+  return value;
+}
+
+}  // namespace
+
+datamon::WriteJournal::WriteJournal(void* address, size_t size,
+                                    size_t capacity)
+    : address_(address), size_(size), ring_(capacity) {
+  pending_.reserve(64);
+
+  watch_id_ = detail::add_watch(
+      address_, size_,
+      [this](const Event& event) {
+        if (event.read) {
+          return;
+        }
+
+        // the page isn't guarded while the fault is handled, so the old value
+        // can be read as is
+        const uintptr_t data = reinterpret_cast<uintptr_t>(event.data);
+        const uint8_t value_size = capture_size(data);
+        const Record record{
+            event.timestamp,
+            event.accessing_address,
+            data - reinterpret_cast<uintptr_t>(address_),
+            read_value(data, value_size),
+            0,
+            value_size,
+            event.thread_id,
+        };
+
+        std::unique_lock lock{mutex_};
+        auto it = std::find_if(
+            pending_.begin(), pending_.end(),
+            [&](const Pending& p) { return p.thread_id == event.thread_id; });
+        if (it != pending_.end()) {
+          it->record = record;
+        } else {
+          pending_.push_back({event.thread_id, record});
+        }
+      },
+      detail::Trap::guard, Context::global(),
+      [this](const Event& event) {
+        std::unique_lock lock{mutex_};
+        auto it = std::find_if(
+            pending_.begin(), pending_.end(),
+            [&](const Pending& p) { return p.thread_id == event.thread_id; });
+        if (it == pending_.end()) {
+          // the journal started in the middle of the write
+          return;
+        }
+
+        Record record = it->record;
+        record.new_value = read_value(
+            reinterpret_cast<uintptr_t>(event.data), record.value_size);
+
+        // swap out instead of erasing to keep the entries of other threads
+        *it = pending_.back();
+        pending_.pop_back();
+
+        if (!ring_.empty()) {
+          ring_[total_ % ring_.size()] = record;
+          ++total_;
+        }
+      });
+}
+
+datamon::WriteJournal::~WriteJournal() {
+  detail::remove_watch(watch_id_, address_, size_);
+}
+
+uint8_t datamon::WriteJournal::capture_size(uintptr_t data) const {
+  const uintptr_t region_end = reinterpret_cast<uintptr_t>(address_) + size_;
+  const uintptr_t page_end =
+      (data & ~(detail::page_size() - 1)) + detail::page_size();
+  return static_cast<uint8_t>(std::min<uintptr_t>(
+      {max_value_size, region_end - data, page_end - data}));
+}
+
+std::vector<datamon::WriteJournal::Record> datamon::WriteJournal::last(
+    size_t count) const {
+  return last(0, size_, count);
+}
+
+std::vector<datamon::WriteJournal::Record> datamon::WriteJournal::last(
+    size_t offset, size_t size, size_t count) const {
+  std::unique_lock lock{mutex_};
+
+  // walk back from the newest record
+  std::vector<Record> records;
+  const uint64_t kept = std::min<uint64_t>(total_, ring_.size());
+  for (uint64_t i = 0; i < kept && records.size() < count; ++i) {
+    const Record& record = ring_[(total_ - 1 - i) % ring_.size()];
+    if (record.offset < offset + size &&
+        offset < record.offset + record.value_size) {
+      records.push_back(record);
+    }
+  }
+
+  std::reverse(records.begin(), records.end());
+  return records;
+}
+
+uint64_t datamon::WriteJournal::total() const {
+  std::unique_lock lock{mutex_};
+  return total_;
+}
\ No newline at end of file
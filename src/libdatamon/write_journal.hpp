@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace datamon {
+
+//! @brief Keeps the most recent writes to a region together with the values
+//! before and after each of them, in a ring allocated up front. The old
+//! value is read when the write faults and the new one after the writing
+//! instruction has executed, before the guard is restored.
+//!
+//! Without decoding the instruction the width of a write is unknown, so up to
+//! 8 bytes are captured from the written address, cut off at the end of the
+//! region and of the page.
+class WriteJournal {
+ public:
+  //! @brief The maximum number of bytes captured per write.
+  static constexpr size_t max_value_size = 8;
+
+  //! @brief A single write.
+  struct Record {
+    //! Steady clock time of the write, in nanoseconds.
+    uint64_t timestamp;
+    //! The address of the code that wrote.
+    void* accessing_address;
+    //! The offset of the written address from the start of the region.
+    size_t offset;
+    //! The bytes at the written address before and after the write, in
+    //! memory order.
+    uint64_t old_value;
+    uint64_t new_value;
+    //! How many bytes of the values were captured.
+    uint8_t value_size;
+    uint32_t thread_id;
+  };
+
+  //! @brief Starts journaling the writes to a region.
+  //! @param address The start of the region to be journaled.
+  //! @param size The size of the region to be journaled.
+  //! @param capacity The number of records kept. Older records are
+  //! overwritten.
+  WriteJournal(void* address, size_t size, size_t capacity = 1000);
+  ~WriteJournal();
+
+  WriteJournal(const WriteJournal&) = delete;
+  WriteJournal(WriteJournal&&) = delete;
+  WriteJournal& operator=(const WriteJournal&) = delete;
+  WriteJournal& operator=(WriteJournal&&) = delete;
+
+  //! @brief The most recent writes, oldest first.
+  //! @param count The maximum number of records to return.
+  std::vector<Record> last(size_t count = SIZE_MAX) const;
+
+  //! @brief The most recent writes to [offset, offset + size) of the region,
+  //! oldest first.
+  //! @param count The maximum number of records to return.
+  std::vector<Record> last(size_t offset, size_t size,
+                           size_t count = SIZE_MAX) const;
+
+  //! @brief The number of writes journaled so far, including the ones that
+  //! have been overwritten.
+  uint64_t total() const;
+
+ private:
+  // the write faulted but the instruction hasn't executed yet
+  struct Pending {
+    uint32_t thread_id;
+    Record record;
+  };
+
+  // the number of bytes that can be captured at an address
+  uint8_t capture_size(uintptr_t data) const;
+
+  void* address_;
+  size_t size_;
+
+  mutable std::mutex mutex_;
+  std::vector<Record> ring_;
+  uint64_t total_ = 0;
+  // one entry per thread in the middle of a write, reused across writes
+  std::vector<Pending> pending_;
+
+  // the ID of the watch entry in the interval tree
+  size_t watch_id_;
+};
+
+}  // namespace datamon
\ No newline at end of file